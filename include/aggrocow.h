@@ -18,6 +18,7 @@
 #ifndef	LIBAGGROCOW_H
 #define	LIBAGGROCOW_H	1
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
@@ -39,7 +40,9 @@ enum ac_rc
 	/* Invalid value(s) provided by the caller */
 	AC_EINVAL,
 	/* System error */
-	AC_OSERR
+	AC_OSERR,
+	/* Memory budget exceeded */
+	AC_NOMEM
 };
 
 enum ac_status
@@ -55,8 +58,46 @@ struct ac_test_case_result
 {
 	/* Largest Minimum Distance for allocating all cows of a given test case. */
 	unsigned long int lmd;
+	/*
+	 * Proven bounds on the Largest Minimum Distance. Unless the result is
+	 * approximate, both are equal to <lmd>.
+	 */
+	unsigned long int lmd_lower;
+	unsigned long int lmd_upper;
+	/*
+	 * Whether processing ran out of budget before the exact result was
+	 * found, in which case <lmd> is the lower bound.
+	 */
+	bool approximate;
 };
 
+/* Order of the stalls handed over by the caller */
+enum ac_stalls_order
+{
+	/* Stalls in any order, to be sorted by the library */
+	AC_STALLS_UNSORTED	= 0,
+	/* Stalls sorted in ascending order */
+	AC_STALLS_SORTED
+};
+
+/* Structure representing limits on the effort of processing test cases */
+struct ac_budget
+{
+	/* Time limit, in milliseconds, or 0 for none */
+	unsigned long int b_msec;
+	/* Limit on the number of feasibility probes per test case, or 0 for none */
+	unsigned long int b_nprobes;
+};
+
+/* Stalls shared by several test cases, see <ac_ctx_add_test_set> */
+struct ac_stalls;
+/* Pool of the stalls shared by the test cases of a context */
+struct ac_stall_pool;
+/* Stalls kept on disk, see <ac_load_opts> */
+struct ac_ooc;
+/* Index of the test cases of an input file, see <ac_index_open> */
+struct ac_index;
+
 /* Structure representing a single test case */
 struct ac_test_case
 {
@@ -66,10 +107,30 @@ struct ac_test_case
 	unsigned long int		 tc_ncows;
 	/* List of stall indices available for cow placement */
 	unsigned long int		*tc_stalls;
+	/* Owner of <tc_stalls> if they are shared with other test cases */
+	struct ac_stalls		*tc_shared;
+	/* Stalls of an out-of-core test case, whose <tc_stalls> is NULL */
+	struct ac_ooc			*tc_ooc;
+	/* Whether <tc_stalls> are borrowed from, and owned by, the caller */
+	bool				 tc_borrowed;
 	/* Result of processing the test case */
 	struct ac_test_case_result	 tc_result;
 };
 
+/* Structure representing a query over a range of a set of stalls */
+struct ac_range_query
+{
+	/* Smallest and largest index of the stalls the cows may be placed in */
+	unsigned long int		 rq_first;
+	unsigned long int		 rq_last;
+	/* Number of cows to allocate */
+	unsigned long int		 rq_ncows;
+	/* Result of the query, if <rq_rc> is <AC_OK> */
+	struct ac_test_case_result	 rq_result;
+	/* Outcome of the query */
+	enum ac_rc			 rq_rc;
+};
+
 /* A type signature of a function handling the results of test cases */
 typedef int (*ac_test_case_result_handler_t)(size_t tcord,
 		struct ac_test_case *tc, struct ac_test_case_result *tcr);
@@ -81,6 +142,8 @@ struct ac_test_set_result
 	size_t ntc;
 	/* Number of successfully processed test cases */
 	size_t nptc;
+	/* Number of processed test cases with an approximate result */
+	size_t napprox;
 	/* Status of the overall set completion */
 	enum ac_status status;
 };
@@ -90,6 +153,11 @@ struct ac_test_set
 {
 	/* Number of test cases in the set */
 	size_t				 ts_ntc;
+	/*
+	 * Number of test cases before the first one of the set in its input,
+	 * non-zero only for a slice of the input, see <ac_load_opts>
+	 */
+	size_t				 ts_first;
 	/* Result of processing the test set */
 	struct ac_test_set_result	 ts_result;
 	/* List of test cases */
@@ -98,6 +166,32 @@ struct ac_test_set
 	char				*ts_inputpath;
 };
 
+/* Options for building a test set from an input file */
+struct ac_load_opts
+{
+	/* Number of threads to parse the input with, 0 or 1 to parse serially */
+	unsigned int	 lo_nworkers;
+	/*
+	 * Memory budget, in bytes, for the stalls of a single test case, or 0
+	 * for none. Test cases with more stalls are kept out of core.
+	 */
+	size_t		 lo_membudget;
+	/* Directory for out-of-core stalls, NULL for $TMPDIR or /tmp */
+	const char	*lo_tmpdir;
+	/*
+	 * Slice of the test cases to build the test set from: the number of
+	 * test cases of the input to skip, and of those to read after them,
+	 * or 0 for all the rest.
+	 */
+	size_t		 lo_first;
+	size_t		 lo_ncases;
+	/*
+	 * Whether to go through the sidecar index of the input, building it
+	 * if there is none yet, see <ac_index_open>
+	 */
+	bool		 lo_index;
+};
+
 /* A type signature of a function handling the results of test sets */
 typedef int (*ac_test_set_result_handler_t)(struct ac_test_set *ts,
 		struct ac_test_set_result *tsr);
@@ -113,6 +207,23 @@ struct ac_ctx
 	ac_test_set_result_handler_t	 ac_ts_result_handler;
 	/* A pointer to a function for test case processing result handling */ 
 	ac_test_case_result_handler_t	 ac_tc_result_handler;
+	/* Limits on processing each test set, unlimited if cleared */
+	struct ac_budget		 ac_budget;
+	/* Whether to deduplicate the stalls of test sets added to the context */
+	bool				 ac_dedup;
+	/* Pool of deduplicated stalls, NULL until the first deduplication */
+	struct ac_stall_pool		*ac_pool;
+	/* Memory, in bytes, the test sets of the context may take, 0 for any */
+	size_t				 ac_membudget;
+	/*
+	 * Memory, in bytes, taken by the test sets of the context, currently
+	 * and at most, including while they were being built, deduplicated
+	 * and processed. Maintained by the library.
+	 */
+	size_t				 ac_memused;
+	size_t				 ac_mempeak;
+	/* Path to write the trace to upon destruction, NULL if not tracing */
+	char				*ac_tracepath;
 };
 
 /* Initialize an allocated <ac_ctx> structure
@@ -137,19 +248,96 @@ void ac_ctx_init(struct ac_ctx *ctx);
  * structure that they should deallocate themselves, without free()'ing its
  * resources.
  *
+ * If <ac_dedup> is set on the context, test cases with the same stalls,
+ * regardless of their order, are made to share a single, reference-counted
+ * copy of them, owned by the context, across all of its test sets. The
+ * memory of the duplicates is released. Upon processing, all the test cases
+ * sharing their stalls are solved back to back while the stalls are hot in
+ * the cache, unless the context has a time limit set in its <ac_budget>.
+ *
+ * If <ac_membudget> is set on the context, the test set is only added if the
+ * memory taken by its test cases and stalls fits in what is left of it.
+ *
  * @return <AC_EINVAL> if either <ctx> or <ts> is a NULL pointer,
+ *         <AC_NOMEM> if the test set does not fit in the memory budget,
  *         <AC_OSERR> upon failure to add the test case,
  *         <AC_OK> otherwise.
  */
 enum ac_rc ac_ctx_add_test_set(struct ac_ctx *ctx, struct ac_test_set *ts);
 
+/* Build a test set by reading from a file at <path> and add it to a context
+ * @ctx pointer to an initialized <ac_ctx> structure
+ * @path path to a file on the local file system containing the test set data
+ * @opts pointer to the options to build the test set with, or NULL for the
+ *       defaults
+ *
+ * Works like <ac_test_set_from_path_opts> followed by <ac_ctx_add_test_set>,
+ * except that the test set is owned by the context right away. If the context
+ * deduplicates stalls, the stalls of test cases found to be duplicates are not
+ * sorted at all.
+ *
+ * Upon failure, nothing is added to the context.
+ *
+ * Every allocation made while building the test set is accounted for, and
+ * with <ac_membudget> set on the context, building it is given up as soon as
+ * the next allocation would not fit in what is left of the budget. As the
+ * stalls of a test case are allocated before they are read, the stalls that
+ * do not fit are never allocated at all. Transient allocations, such as those
+ * of a parallel parse or of an out-of-core sort, count towards the budget
+ * while they last. The mapping of a file read in parallel does not, as it is
+ * backed by the file itself. A test set turned away for the lack of memory
+ * may fit once <ac_ctx_clear> has dropped the test sets before it, whereas
+ * one turned away by an empty context never will.
+ *
+ * @return <AC_EINVAL> if <ctx> is a NULL pointer,
+ *         <AC_NOMEM> if the test set does not fit in the memory budget,
+ *         otherwise just like <ac_test_set_from_path> and
+ *         <ac_ctx_add_test_set>.
+ */
+enum ac_rc ac_ctx_add_test_set_from_path(struct ac_ctx *ctx, const char *path,
+		const struct ac_load_opts *opts);
+
+/* Enable tracing of test set and case processing
+ * @ctx pointer to an initialized <ac_ctx> structure
+ * @path path to the file to write the trace to
+ *
+ * Starts recording spans for the reading of test sets, sorting of stalls,
+ * processing of test cases and handling of their results. Each span carries
+ * the id the operating system gave the recording thread, the path of the test
+ * set, the ordinal of the test case and its number of stalls and cows, where
+ * known.
+ *
+ * Tracing is process-wide: spans of every thread using the library are
+ * recorded, including those of test sets not (yet) added to <ctx>. The trace
+ * is written to <path> in the Chrome trace-event JSON format, as understood
+ * by chrome://tracing and Perfetto, upon <ac_ctx_destroy>. Each thread keeps
+ * only its most recent spans.
+ *
+ * Note: only one context may be tracing at a time.
+ *
+ * @return <AC_EINVAL> if <ctx> or <path> is a NULL pointer, or <path> is an
+ *         empty string,
+ *         <AC_CONFIG> if tracing is already enabled,
+ *         <AC_OSERR> upon failure to allocate memory,
+ *         <AC_OK> otherwise.
+ */
+enum ac_rc ac_ctx_trace(struct ac_ctx *ctx, const char *path);
+
 /* Processes all test sets currently assigned to the context
  * @ctx pointer to a <ac_ctx> structure with assigned test cases.
  *
- * Iterates over the list of known test sets and processes each in turn.
- * The processing stops upon the first failed test set.
+ * Iterates over the list of known test sets and processes each in turn,
+ * within the limits of the contexts <ac_budget>, as per
+ * <ac_test_set_process_budget>. The processing stops upon the first failed
+ * test set.
  *
- * @return <AC_OK> upon success; upon failure, returns just like
+ * Memory taken while processing, such as the buffers that out-of-core test
+ * cases are read through, counts towards the <ac_membudget> of the context
+ * and its <ac_mempeak>, on top of the test sets themselves.
+ *
+ * @return <AC_NOMEM> if the memory taken while processing a test case does
+ *         not fit in what is left of the memory budget,
+ *         <AC_OK> upon success; upon other failures, returns just like
  *         <ac_test_case_process>.
  */
 enum ac_rc ac_ctx_process_test_sets(struct ac_ctx *ctx);
@@ -160,18 +348,34 @@ enum ac_rc ac_ctx_process_test_sets(struct ac_ctx *ctx);
  * Invokes the associated <ac_ts_result_handler> of the given context for every
  * test set of the given context object, if it is set. If the handler returns
  * success (0), and an <ac_tc_result_handler> for the given context is set,
- * invokes that in turn for every <ac_test_case> of the test set.
+ * invokes that in turn for every <ac_test_case> of the test set, along with
+ * its ordinal in the input, counting from <ts_first> + 1.
  *
  * Note: if the context has no test set result handler installed, the test case
  * result handler is *not* invoked.
  */
 void ac_ctx_process_results(struct ac_ctx *ctx);
 
+/* Drop all test sets of a context
+ * @ctx pointer to an initialized <ac_ctx> structure
+ *
+ * Deallocates the test sets of the context, along with their test cases and
+ * any deduplicated stalls, so that the memory they took counts no longer
+ * against its <ac_membudget>. Everything else, including the result handlers,
+ * limits, tracing and <ac_mempeak>, is kept, so further test sets can be
+ * added to the context and processed as before.
+ *
+ * In the case that <ctx> is a NULL pointer, gracefully returns.
+ */
+void ac_ctx_clear(struct ac_ctx *ctx);
+
 /* Destroy an allocated <ac_ctx> structure
  * @ctx pointer to an allocatad <ac_ctx> structure
  *
  * Deallocates any resources associated with the context object, including test
  * sets and any test cases, as well as removes any installed result handlers.
+ * If tracing was enabled via <ac_ctx_trace>, stops it and writes out the
+ * trace; failure to write it is not reported.
  * The resulting context object is *not* reusable without prior
  * reinitialization via a call to <ac_ctx_init>.
  *
@@ -192,6 +396,137 @@ void ac_ctx_destroy(struct ac_ctx *ctx);
  */
 enum ac_rc ac_test_set_from_path(const char *path, struct ac_test_set *ts);
 
+/* Builds an <ac_test_set> in <ts> by reading from a file at <path>, with options
+ * @path path to a file on the local file system containing the test set data
+ * @opts pointer to the options to build the test set with, or NULL for the
+ *       defaults
+ * @ts pointer to an allocated <ac_test_set> structure to hold the test data
+ *
+ * With <lo_nworkers> above one, a regular file is mapped into memory and
+ * parsed in parallel: a quick scan finds the test cases, after which worker
+ * threads parse the stalls of different test cases, or different parts of a
+ * single large one, and sort them. The resulting test set, and the return
+ * code upon failure, are the same as those of the serial reader. The standard
+ * input and other files that cannot be mapped are read serially.
+ *
+ * With <lo_membudget> set, test cases whose stalls take more memory than the
+ * budget are kept out of core: their stalls are sorted externally, through
+ * temporary files in <lo_tmpdir>, and every step of processing them is a
+ * sequential pass over the sorted stalls on disk. Such test cases have no
+ * <tc_stalls>, yet give the same results as if they were kept in memory. The
+ * budget, which must be at least 1 MiB, bounds the memory used for each such
+ * test case while it is read and processed, buffers and the bookkeeping of
+ * the sort alike. A test case with so many stalls that keeping track of its
+ * sorted runs would take more than half of the budget is rejected with
+ * <AC_EINVAL>. Inputs are read serially when a budget is set.
+ *
+ * With <lo_first> or <lo_ncases> set, only that slice of the test cases is
+ * read into the test set, whose <ts_first> is set to <lo_first>. The test
+ * cases before it are skipped over a line at a time, without parsing their
+ * stalls, and the ones after it are not read at all, so errors in either go
+ * unnoticed. A slice starting past the last test case is empty. Slices are
+ * read serially.
+ *
+ * With <lo_index> set, the index of a regular file is opened, or built and
+ * persisted upon the first read, as per <ac_index_open>, whenever a slice
+ * starting past the first test case is asked for. The slice is then read
+ * straight from its first test case, instead of skipping over the ones before
+ * it. Inputs that cannot be indexed, such as malformed ones or ones that
+ * cannot be mapped, are read just as they would be without an index, whereas
+ * failing to allocate memory for an index fails the read. Like the mapping of
+ * a file read in parallel, a mapped index does not count towards the memory
+ * budget of a context, but one kept in memory does.
+ *
+ * @return just like <ac_test_set_from_path>.
+ */
+enum ac_rc ac_test_set_from_path_opts(const char *path,
+		const struct ac_load_opts *opts, struct ac_test_set *ts);
+
+/* Read the number of test cases in the input file at <path>
+ * @path path to a file on the local file system containing the test set data
+ * @ncases pointer to store the number of test cases to
+ *
+ * Reads nothing but the first line of the input, so it is a cheap way to
+ * split the test cases of inputs into slices, see <ac_load_opts>.
+ *
+ * @return <AC_EINVAL> if either <path> or <ncases> is a NULL pointer, or
+ *         <path> is an empty string or the standard input ("-"),
+ *         <AC_NOINPUT> if the file could not be opened,
+ *         <AC_DATAERR> or <AC_IOERR> just like <ac_test_set_from_path> upon
+ *         failing to read the number of test cases,
+ *         <AC_OK> otherwise.
+ */
+enum ac_rc ac_test_set_ncases(const char *path, size_t *ncases);
+
+/* Open the sidecar index of the test cases of an input file
+ * @path path to a regular file on the local file system containing the test
+ *       set data
+ * @ixp pointer to store a pointer to the index to
+ *
+ * The index holds the offset of every test case in the file, along with its
+ * number of stalls and cows, so that test cases can be read at random with
+ * <ac_index_test_case>, without parsing the ones before them.
+ *
+ * The index is kept next to the input, at <path> with ".acidx" appended, and
+ * is only used if it was built from a file of the very same size and
+ * modification time. Otherwise, it is built by a single pass over the input
+ * and written out for the next time, with the permission bits of the input,
+ * save for when it cannot be: an index that cannot be written is kept in
+ * memory. The index records a checksum of the input, too, which
+ * <ac_index_verify> checks the input against. Indices are written in the byte
+ * order of the host, and ones of any other byte order are built anew.
+ *
+ * An index is only built for an input whose test cases are all there, so an
+ * input that fails to be indexed would fail to be read as well, though not
+ * necessarily with the same return code.
+ *
+ * @return <AC_EINVAL> if either <path> or <ixp> is a NULL pointer, or <path>
+ *         is an empty string or not a regular file,
+ *         <AC_NOINPUT> if the file could not be opened,
+ *         <AC_DATAERR> if the file is malformed,
+ *         <AC_IOERR> upon failure to map the file,
+ *         <AC_OSERR> upon failure to allocate memory,
+ *         <AC_OK> otherwise.
+ */
+enum ac_rc ac_index_open(const char *path, struct ac_index **ixp);
+
+/* Return the number of test cases in the input of an index */
+size_t ac_index_ncases(const struct ac_index *ix);
+
+/* Read a single test case of an indexed input
+ * @ix pointer to an index opened by <ac_index_open>
+ * @i index of the test case in the input, counting from 0
+ * @tc pointer to an instance of <ac_test_case> to fill with test data
+ *
+ * Goes straight to the test case in the input and reads it, with its stalls
+ * sorted, just like <ac_test_set_from_path> would.
+ *
+ * Note: an index may only be read by a single thread at a time.
+ *
+ * @return <AC_EINVAL> if either <ix> or <tc> is a NULL pointer, or the input
+ *         has no test case <i>,
+ *         <AC_DATAERR> if the test case does not match the index, which is
+ *         then out of date,
+ *         otherwise just like <ac_test_set_from_path>.
+ */
+enum ac_rc ac_index_test_case(struct ac_index *ix, size_t i,
+		struct ac_test_case *tc);
+
+/* Check the input of an index against the checksum in the index
+ *
+ * Reads the input in full, so it is only worth it for inputs whose
+ * modification time may not be trusted to change along with their contents.
+ *
+ * @return <AC_EINVAL> if <ix> is a NULL pointer,
+ *         <AC_OSERR> upon failure to map the input,
+ *         <AC_DATAERR> if the input no longer matches the index,
+ *         <AC_OK> otherwise.
+ */
+enum ac_rc ac_index_verify(const struct ac_index *ix);
+
+/* Close an index opened by <ac_index_open> and deallocate it */
+void ac_index_close(struct ac_index *ix);
+
 /* Process test cases of a given test set
  * @ts pointer to an instance of <ac_test_set>
  *
@@ -204,6 +539,21 @@ enum ac_rc ac_test_set_from_path(const char *path, struct ac_test_set *ts);
  */
 enum ac_rc ac_test_set_process(struct ac_test_set *ts);
 
+/* Process test cases of a given test set within a budget
+ * @ts pointer to an instance of <ac_test_set>
+ * @budget pointer to the limits on processing, or NULL for none
+ *
+ * Works just like <ac_test_set_process>, except that the time limit of
+ * <budget> applies across the whole test set and the probe limit to each of
+ * its test cases. Once the time runs out, every remaining test case is given
+ * an approximate result right away. The number of approximate results is
+ * kept in the <napprox> field of the test sets <ac_test_set_result>.
+ *
+ * @return just like <ac_test_set_process>.
+ */
+enum ac_rc ac_test_set_process_budget(struct ac_test_set *ts,
+		const struct ac_budget *budget);
+
 void ac_test_set_destroy(struct ac_test_set *ts);
 
 /* Assemble an instance of struct <ac_test_case> from its constituent parts
@@ -216,6 +566,10 @@ void ac_test_set_destroy(struct ac_test_set *ts);
  * Clears the memory pointed to by <tc> and writes the test case data
  * given by the caller.
  *
+ * The test case takes ownership of <stalls>, which must be allocated with
+ * malloc(3) and sorted in ascending order. See <ac_test_case_from_borrowed>
+ * for stalls that stay with the caller.
+ *
  * @return <AC_EINVAL> if any of <nstalls> or <ncows> is 0, or <stalls> or
  *         <tc> are NULL pointers, otherwise <AC_OK>.
  */
@@ -223,16 +577,128 @@ enum ac_rc ac_test_case_from_parts(unsigned long int nstalls,
 		unsigned long int ncows, unsigned long int *stalls,
 		struct ac_test_case *tc);
 
+/* Assemble an instance of struct <ac_test_case> around stalls of the caller
+ * @nstalls number of stalls available for cow placement
+ * @ncows number of cows available for placement
+ * @stalls pointer to an array, of length <nstalls>, of available stall indices
+ * @order order of the stalls in <stalls>
+ * @tc pointer to an instance of struct <ac_test_case> to fill with test data
+ *
+ * Works like <ac_test_case_from_parts>, except that <stalls> remain the
+ * callers own. They are neither written to nor free()'d by the library.
+ *
+ * Sorted stalls are used in place, without being copied, and must outlive the
+ * test case. Unsorted stalls are sorted into a scratch buffer owned by the
+ * test case instead, after which the caller is free to reuse <stalls>.
+ *
+ * Test cases with sorted, borrowed stalls are left out of the deduplication
+ * of <ac_ctx_add_test_set>, and do not count against the memory budget of
+ * a context.
+ *
+ * @return <AC_EINVAL> just like <ac_test_case_from_parts>,
+ *         <AC_OSERR> upon failure to allocate the scratch buffer,
+ *         otherwise <AC_OK>.
+ */
+enum ac_rc ac_test_case_from_borrowed(size_t nstalls, unsigned long int ncows,
+		const unsigned long int *stalls, enum ac_stalls_order order,
+		struct ac_test_case *tc);
+
+/* Process a batch of test cases laid out by the caller as arrays
+ * @ncases number of test cases in the batch
+ * @nstalls pointer to an array, of length <ncases>, of the number of stalls
+ *          of each test case
+ * @ncows pointer to an array, of length <ncases>, of the number of cows of
+ *        each test case
+ * @stalls pointer to the stalls of all test cases, those of each test case
+ *         following those of the one before it
+ * @order order of the stalls of each test case in <stalls>
+ * @budget pointer to the limits on processing, or NULL for none
+ * @results pointer to an array, of length <ncases>, to write the result of
+ *          each test case to
+ *
+ * Solves every test case just like <ac_test_case_process_budget> would, with
+ * the time limit of <budget> applying across the whole batch, as it would
+ * across a test set. No <ac_test_case> is built and the stalls are never
+ * copied, unless they are unsorted: the stalls of each test case are then
+ * sorted in a single scratch buffer, reused across the batch. Being bound to
+ * no context, the batch counts towards no <ac_membudget>.
+ *
+ * All test cases are checked before any is solved.
+ *
+ * @return <AC_EINVAL> if <ncases> is 0, any of the pointers is NULL or any of
+ *         the test cases has no stalls, no cows or fewer stalls than cows,
+ *         <AC_OSERR> upon failure to allocate the scratch buffer,
+ *         <AC_OK> otherwise.
+ */
+enum ac_rc ac_batch_process(size_t ncases, const size_t *nstalls,
+		const unsigned long int *ncows, const unsigned long int *stalls,
+		enum ac_stalls_order order, const struct ac_budget *budget,
+		struct ac_test_case_result *results);
+
+/* Process a batch of range queries over a single set of stalls
+ * @nstalls number of stalls in <stalls>
+ * @stalls pointer to an array, of length <nstalls>, of stall indices
+ * @order order of the stalls in <stalls>
+ * @nqueries number of queries in <queries>
+ * @queries pointer to an array, of length <nqueries>, of queries
+ * @nworkers number of threads to process the queries with, including the
+ *           calling one, 0 or 1 to process them serially
+ *
+ * Answers every query with the result of a test case made of the stalls whose
+ * indices lie between <rq_first> and <rq_last>, inclusive, and <rq_ncows>
+ * cows, without copying any stalls. The result, and the outcome in <rq_rc>,
+ * are the same as those of <ac_test_case_process> on such a test case. Queries
+ * with <rq_first> above <rq_last>, or with fewer stalls in range than cows,
+ * fail with <AC_EINVAL> while the rest are still answered.
+ *
+ * The queries are answered in an order of the libraries choosing, such that
+ * the same query is not answered twice, and the result of a query bounds the
+ * search of those starting at the same stall, with the same number of cows,
+ * over a range contained in its own. Queries starting at different stalls, or
+ * with different numbers of cows, gain nothing from each other; beyond not
+ * copying any stalls, nor does any query over a range overlapping another
+ * without being contained in it. Unsorted stalls are sorted into a scratch
+ * buffer first, leaving the callers <stalls> alone. Like <ac_batch_process>,
+ * the memory taken counts towards no <ac_membudget>.
+ *
+ * @return <AC_EINVAL> if <nstalls> is 0, or <stalls> or <queries> is a NULL
+ *         pointer,
+ *         <AC_OSERR> upon failure to allocate memory,
+ *         <AC_OK> otherwise.
+ */
+enum ac_rc ac_range_process(size_t nstalls, const unsigned long int *stalls,
+		enum ac_stalls_order order, size_t nqueries,
+		struct ac_range_query *queries, unsigned int nworkers);
+
 /* Process a given test case
  * @tc pointer to an instance of <ac_test_case>
  *
  * Processes the test case given in <tc> and, upon success, writes the result
  * to the associated <ac_test_case_result> structure.  
  *
- * @return <AC_EINVAL> if <tc> is a NULL pointer, <AC_OK> otherwise.
+ * @return <AC_EINVAL> if <tc> is a NULL pointer,
+ *         <AC_OSERR> or <AC_IOERR> upon failing to allocate memory for or to
+ *         read the stalls of an out-of-core test case,
+ *         <AC_OK> otherwise.
  */
 enum ac_rc ac_test_case_process(struct ac_test_case *tc);
 
+/* Process a given test case within a budget
+ * @tc pointer to an instance of <ac_test_case>
+ * @budget pointer to the limits on processing, or NULL for none
+ *
+ * Works just like <ac_test_case_process>, except that the search for the
+ * result is cut short once either of the limits of <budget> is reached. The
+ * bounds proven by then are written to the <lmd_lower> and <lmd_upper> fields
+ * of the test cases <ac_test_case_result>, which is flagged as approximate.
+ * A test case of a single cow takes no search at all, so its result is always
+ * exact.
+ *
+ * @return just like <ac_test_case_process>.
+ */
+enum ac_rc ac_test_case_process_budget(struct ac_test_case *tc,
+		const struct ac_budget *budget);
+
 /* Destroy an allocated <ac_test_case> structure
  * @tc pointer to an instance of <ac_test_case>
  *
@@ -243,6 +709,19 @@ enum ac_rc ac_test_case_process(struct ac_test_case *tc);
  */
 void ac_test_case_destroy(struct ac_test_case *tc);
 
+/* Return the name of the instruction set the solver runs on
+ *
+ * The feasibility test at the core of <ac_test_case_process> is built for
+ * several instruction sets, one of which is selected for the running CPU when
+ * the library is loaded: "avx512", "avx2", "sse4.2" or "scalar". Setting the
+ * AGGROCOW_KERNEL environment variable to one of these names overrides the
+ * selection, provided that the CPU supports the named instruction set.
+ *
+ * The returned string is statically allocated and should *not* be free()'d by
+ * the caller.
+ */
+const char *ac_kernel_isa(void);
+
 /* Return string describing the given return code 
  * @rc a variant of the <ac_rc> enumerator
  *
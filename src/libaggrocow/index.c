@@ -0,0 +1,500 @@
+/* SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2022 Juris Miščenko <jxlambda@protonmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Sidecar indices of input files.
+ *
+ * An index is a header identifying the input it was built from, followed by
+ * an entry for every test case of the input, with the offset of its first
+ * line. Both are written out as they are laid out in memory, and the index is
+ * mapped back into memory as is, so opening one takes no time at all,
+ * regardless of the size of the input.
+ *
+ * The index is built from a mapping of the input, going over it a line at a
+ * time, where a line is whatever fgets(3) would read into a buffer of BUFSIZ
+ * bytes. The offsets are then exactly where reading the input serially would
+ * have gotten to.
+ *
+ * It is written to a temporary file next to the input first, entry by entry,
+ * which is then mapped in and renamed over the index, so that processes
+ * indexing the same input at once never see a partial index. Only if there
+ * is no writing next to the input is the index built in memory.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "internal.h"
+
+#define	INDEX_SUFFIX	".acidx"
+#define	INDEX_MAGIC	"ACIDX001"
+/* Written in the byte order of the host, to tell apart other byte orders */
+#define	INDEX_BYTEORDER	UINT64_C(0x0102030405060708)
+
+#define	FNV1A_OFFSET	UINT64_C(0xcbf29ce484222325)
+#define	FNV1A_PRIME	UINT64_C(0x100000001b3)
+
+struct index_header
+{
+	char		ih_magic[8];
+	uint64_t	ih_byteorder;
+	/* Size and modification time of the input */
+	uint64_t	ih_size;
+	int64_t		ih_mtime_sec;
+	int64_t		ih_mtime_nsec;
+	/* 64-bit FNV-1a hash of the contents of the input */
+	uint64_t	ih_checksum;
+	uint64_t	ih_ncases;
+};
+
+struct index_entry
+{
+	/* Offset of the first line of the test case in the input */
+	uint64_t	ie_offset;
+	uint64_t	ie_nstalls;
+	uint64_t	ie_ncows;
+};
+
+struct ac_index
+{
+	/* The input, open for reading test cases */
+	FILE				*ix_fp;
+	struct index_header		 ix_header;
+	const struct index_entry	*ix_entries;
+	/* Mapping of the index file, or NULL if the index was built */
+	void				*ix_map;
+	size_t				 ix_maplen;
+	/* Entries of a built index, charged to <ix_acct> */
+	struct index_entry		*ix_built;
+	struct mem_acct			*ix_acct;
+};
+
+static uint64_t checksum(const char *buf, size_t len)
+{
+	uint64_t h = FNV1A_OFFSET;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+	{
+		h ^= (unsigned char)buf[i];
+		h *= FNV1A_PRIME;
+	}
+
+	return h;
+}
+
+size_t line_end(const char *buf, size_t len, size_t pos)
+{
+	size_t max = len - pos;
+	const char *nl;
+
+	if (max > BUFSIZ - 1)
+		max = BUFSIZ - 1;
+
+	nl = (const char *)memchr(&buf[pos], '\n', max);
+
+	return (NULL != nl) ? (size_t)(nl - buf) + 1 : pos + max;
+}
+
+/* Copy the line at <pos> into <line>, of BUFSIZ bytes, and move past it */
+static bool read_line(const char *buf, size_t len, size_t *pos, char *line)
+{
+	size_t end;
+
+	if (*pos == len)
+		return false;
+
+	end = line_end(buf, len, *pos);
+
+	memcpy(line, &buf[*pos], end - *pos);
+	line[end - *pos] = '\0';
+
+	*pos = end;
+
+	return true;
+}
+
+/*
+ * Finds every test case of a mapped input, writing the entries out to <out>
+ * if it is not NULL, and into <ix_built> otherwise.
+ */
+static enum ac_rc index_build(const char *buf, size_t len, FILE *out,
+		struct mem_acct *ma, struct ac_index *ix)
+{
+	struct index_entry ie;
+	enum ac_rc ret;
+	char line[BUFSIZ];
+	size_t i, j, ncases, nstalls, pos = 0;
+	unsigned long int ncows;
+
+	if (!read_line(buf, len, &pos, line) ||
+			1 != sscanf(line, "%zu", &ncases))
+		return AC_DATAERR;
+
+	/* Every test case takes up a line at least */
+	if (ncases > len - pos)
+		return AC_DATAERR;
+
+	ix->ix_header.ih_ncases = ncases;
+
+	if (NULL != out)
+	{
+		if (1 != fwrite(&ix->ix_header, sizeof(ix->ix_header), 1, out))
+			return AC_IOERR;
+	}
+	else
+	{
+		if (AC_OK != (ret = mem_charge(ma, ncases, sizeof(ie))))
+			return ret;
+
+		ix->ix_built = (struct index_entry *)reallocarray(NULL,
+				(0 == ncases) ? 1 : ncases, sizeof(ie));
+		if (NULL == ix->ix_built)
+		{
+			mem_release(ma, ncases, sizeof(ie));
+
+			return AC_OSERR;
+		}
+
+		ix->ix_acct = ma;
+	}
+
+	for (i = 0; i < ncases; i++)
+	{
+		ie.ie_offset = pos;
+
+		if (!read_line(buf, len, &pos, line) ||
+				2 != sscanf(line, "%zu %lu", &nstalls, &ncows) ||
+				nstalls > len - pos)
+			return AC_DATAERR;
+
+		for (j = 0; j < nstalls && pos < len; j++)
+			pos = line_end(buf, len, pos);
+
+		if (j < nstalls)
+			return AC_DATAERR;
+
+		ie.ie_nstalls = nstalls;
+		ie.ie_ncows = ncows;
+
+		if (NULL == out)
+			ix->ix_built[i] = ie;
+		else if (1 != fwrite(&ie, sizeof(ie), 1, out))
+			return AC_IOERR;
+	}
+
+	ix->ix_header.ih_checksum = checksum(buf, len);
+
+	/* The checksum is only known by now */
+	if (NULL != out && (0 != fseeko(out, 0, SEEK_SET) ||
+			1 != fwrite(&ix->ix_header, sizeof(ix->ix_header), 1,
+				out) ||
+			0 != fflush(out)))
+		return AC_IOERR;
+
+	ix->ix_entries = ix->ix_built;
+
+	return AC_OK;
+}
+
+/* Map an index file in, if it was built from the input as it is now */
+static bool index_load(int fd, const struct index_header *want,
+		struct ac_index *ix)
+{
+	struct index_header ih;
+	struct stat st;
+	size_t len;
+	void *map;
+
+	if (-1 == fstat(fd, &st) || !S_ISREG(st.st_mode) ||
+			(size_t)st.st_size < sizeof(ih))
+		return false;
+
+	len = (size_t)st.st_size;
+	map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (MAP_FAILED == map)
+		return false;
+
+	memcpy(&ih, map, sizeof(ih));
+
+	if (0 != memcmp(ih.ih_magic, want->ih_magic, sizeof(ih.ih_magic)) ||
+			want->ih_byteorder != ih.ih_byteorder ||
+			want->ih_size != ih.ih_size ||
+			want->ih_mtime_sec != ih.ih_mtime_sec ||
+			want->ih_mtime_nsec != ih.ih_mtime_nsec ||
+			ih.ih_ncases != (len - sizeof(ih)) /
+				sizeof(struct index_entry) ||
+			0 != (len - sizeof(ih)) % sizeof(struct index_entry))
+	{
+		munmap(map, len);
+
+		return false;
+	}
+
+	ix->ix_header = ih;
+	ix->ix_entries = (const struct index_entry *)((char *)map + sizeof(ih));
+	ix->ix_map = map;
+	ix->ix_maplen = len;
+
+	return true;
+}
+
+/*
+ * Builds the index of an input into a temporary file next to it, which is
+ * then mapped in and renamed over the index. Without such a file, the index
+ * is built in memory instead.
+ */
+static enum ac_rc index_create(const char *ixpath, const char *buf,
+		size_t len, mode_t mode, struct mem_acct *ma, struct ac_index *ix)
+{
+	char tmppath[4096];
+	enum ac_rc ret;
+	FILE *out = NULL;
+	int n, fd = -1;
+
+	n = snprintf(tmppath, sizeof(tmppath), "%s.XXXXXX", ixpath);
+	if (n >= 0 && (size_t)n < sizeof(tmppath))
+		fd = mkstemp(tmppath);
+
+	if (-1 != fd && NULL == (out = fdopen(fd, "w+")))
+	{
+		close(fd);
+		unlink(tmppath);
+	}
+
+	if (NULL != out)
+	{
+		ret = index_build(buf, len, out, ma, ix);
+
+		/* Whoever may read the input, and no one else, may read its index */
+		if (AC_OK == ret && (-1 == fchmod(fileno(out), mode) ||
+				!index_load(fileno(out), &ix->ix_header, ix)))
+			ret = AC_IOERR;
+
+		if (AC_OK != ret || -1 == rename(tmppath, ixpath))
+			unlink(tmppath);
+
+		fclose(out);
+
+		/* A malformed input would not do any better in memory */
+		if (AC_IOERR != ret)
+			return ret;
+	}
+
+	return index_build(buf, len, NULL, ma, ix);
+}
+
+/*
+ * Build the index of an open input, through a mapping of it, with the
+ * permission bits of the input in <mode>
+ */
+static enum ac_rc index_map_create(const char *ixpath, int fd, size_t len,
+		mode_t mode, struct mem_acct *ma, struct ac_index *ix)
+{
+	enum ac_rc ret;
+	void *buf;
+
+	buf = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (MAP_FAILED == buf)
+		return AC_IOERR;
+
+	ret = index_create(ixpath, (const char *)buf, len, mode, ma, ix);
+
+	munmap(buf, len);
+
+	return ret;
+}
+
+enum ac_rc index_open(const char *path, struct mem_acct *ma,
+		struct ac_index **ixp)
+{
+	struct ac_index *ix;
+	enum ac_rc ret = AC_OK;
+	struct stat st;
+	char *ixpath;
+	bool loaded = false;
+	int fd;
+
+	if (NULL == path || NULL == ixp)
+		return AC_EINVAL;
+
+	*ixp = NULL;
+
+	if (0 == strlen(path) || 0 == strcmp(path, "-"))
+		return AC_EINVAL;
+
+	ix = (struct ac_index *)calloc(1, sizeof(*ix));
+	ixpath = (char *)malloc(strlen(path) + sizeof(INDEX_SUFFIX));
+	if (NULL == ix || NULL == ixpath)
+	{
+		free(ixpath);
+		free(ix);
+
+		return AC_OSERR;
+	}
+
+	memcpy(ixpath, path, strlen(path));
+	memcpy(&ixpath[strlen(path)], INDEX_SUFFIX, sizeof(INDEX_SUFFIX));
+
+	if (NULL == (ix->ix_fp = fopen(path, "r")))
+		ret = AC_NOINPUT;
+	else if (-1 == fstat(fileno(ix->ix_fp), &st))
+		ret = AC_OSERR;
+	else if (!S_ISREG(st.st_mode))
+		ret = AC_EINVAL;
+	else if (0 == st.st_size)
+		ret = AC_DATAERR;
+
+	if (AC_OK == ret)
+	{
+		struct index_header *ih = &ix->ix_header;
+
+		memcpy(ih->ih_magic, INDEX_MAGIC, sizeof(ih->ih_magic));
+		ih->ih_byteorder = INDEX_BYTEORDER;
+		ih->ih_size = (uint64_t)st.st_size;
+		ih->ih_mtime_sec = (int64_t)st.st_mtim.tv_sec;
+		ih->ih_mtime_nsec = (int64_t)st.st_mtim.tv_nsec;
+
+		if (-1 != (fd = open(ixpath, O_RDONLY)))
+		{
+			loaded = index_load(fd, ih, ix);
+			close(fd);
+		}
+
+		if (!loaded)
+			ret = index_map_create(ixpath, fileno(ix->ix_fp),
+					(size_t)st.st_size, st.st_mode &
+					(S_IRWXU | S_IRWXG | S_IRWXO), ma, ix);
+	}
+
+	free(ixpath);
+
+	if (AC_OK != ret)
+	{
+		ac_index_close(ix);
+
+		return ret;
+	}
+
+	*ixp = ix;
+
+	return AC_OK;
+}
+
+enum ac_rc ac_index_open(const char *path, struct ac_index **ixp)
+{
+	return index_open(path, NULL, ixp);
+}
+
+size_t ac_index_ncases(const struct ac_index *ix)
+{
+	return (NULL == ix) ? 0 : (size_t)ix->ix_header.ih_ncases;
+}
+
+FILE *index_seek(struct ac_index *ix, size_t i)
+{
+	const struct index_entry *ie;
+
+	if (i >= ix->ix_header.ih_ncases)
+		return NULL;
+
+	ie = &ix->ix_entries[i];
+
+	if (ie->ie_offset >= ix->ix_header.ih_size ||
+			0 != fseeko(ix->ix_fp, (off_t)ie->ie_offset, SEEK_SET))
+		return NULL;
+
+	return ix->ix_fp;
+}
+
+enum ac_rc ac_index_test_case(struct ac_index *ix, size_t i,
+		struct ac_test_case *tc)
+{
+	const struct index_entry *ie;
+	enum ac_rc ret;
+	FILE *fp;
+
+	if (NULL == ix || NULL == tc || i >= ix->ix_header.ih_ncases)
+		return AC_EINVAL;
+
+	if (NULL == (fp = index_seek(ix, i)))
+		return AC_DATAERR;
+
+	if (AC_OK != (ret = test_case_from_file(fp, NULL, true, NULL, tc)))
+		return ret;
+
+	ie = &ix->ix_entries[i];
+
+	if (ie->ie_nstalls != tc->tc_nstalls || ie->ie_ncows != tc->tc_ncows)
+	{
+		ac_test_case_destroy(tc);
+
+		return AC_DATAERR;
+	}
+
+	return AC_OK;
+}
+
+enum ac_rc ac_index_verify(const struct ac_index *ix)
+{
+	struct stat st;
+	uint64_t sum;
+	void *buf;
+
+	if (NULL == ix)
+		return AC_EINVAL;
+
+	if (-1 == fstat(fileno(ix->ix_fp), &st))
+		return AC_OSERR;
+
+	if ((uint64_t)st.st_size != ix->ix_header.ih_size)
+		return AC_DATAERR;
+
+	buf = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE,
+			fileno(ix->ix_fp), 0);
+	if (MAP_FAILED == buf)
+		return AC_OSERR;
+
+	sum = checksum((const char *)buf, (size_t)st.st_size);
+
+	munmap(buf, (size_t)st.st_size);
+
+	return (sum == ix->ix_header.ih_checksum) ? AC_OK : AC_DATAERR;
+}
+
+void ac_index_close(struct ac_index *ix)
+{
+	if (NULL == ix)
+		return;
+
+	if (NULL != ix->ix_map)
+		munmap(ix->ix_map, ix->ix_maplen);
+
+	if (NULL != ix->ix_built)
+		mem_release(ix->ix_acct, ix->ix_header.ih_ncases,
+				sizeof(*ix->ix_built));
+
+	if (NULL != ix->ix_fp)
+		fclose(ix->ix_fp);
+
+	free(ix->ix_built);
+	free(ix);
+}
@@ -0,0 +1,477 @@
+/* SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2022 Juris Miščenko <jxlambda@protonmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Parallel ingest of a single test set file.
+ *
+ * The file is processed in three phases:
+ *
+ *  1. A serial scan finds the header line of every test case, and splits the
+ *     stall lines of each case into chunks of at most <INGEST_CHUNK> lines.
+ *     The scan only looks for line ends, it does not parse stall lines.
+ *  2. Worker threads parse the chunks straight into the stall arrays of their
+ *     test cases, so a single huge case is parsed by many threads at once.
+ *  3. Worker threads sort the stalls of the test cases.
+ *
+ * The serial reader stops at the first test case it fails to read. To report
+ * the same error, every test case records what went wrong with it, in the
+ * order the serial reader would have run into it, and the first failed test
+ * case in file order decides the outcome. Test cases following it are
+ * discarded.
+ *
+ * Lines are split wherever the serial reader splits them, long ones included,
+ * see <line_end>.
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <string.h>
+
+#include "internal.h"
+#include "trace.h"
+
+/* Maximum number of stall lines per chunk of work */
+#define	INGEST_CHUNK	(1U << 16)
+
+/* Progress of a test case through the ingest */
+struct ingest_case
+{
+	size_t			 ic_nstalls;
+	unsigned long int	 ic_ncows;
+	unsigned long int	*ic_stalls;
+	/* Number of stall lines present in the input */
+	size_t			 ic_nlines;
+	/* Failure to parse the stall lines, <AC_OK> if none */
+	_Atomic(enum ac_rc)	 ic_rc;
+};
+
+/* A run of stall lines of a single test case */
+struct ingest_chunk
+{
+	/* Offset of the first line in the input */
+	size_t	ck_off;
+	/* Test case the lines belong to */
+	size_t	ck_case;
+	/* Index of the first stall of the chunk within its test case */
+	size_t	ck_first;
+	size_t	ck_nlines;
+};
+
+struct ingest
+{
+	const char		*in_buf;
+	size_t			 in_len;
+	struct ingest_case	*in_cases;
+	/* Number of test cases whose stalls are to be parsed */
+	size_t			 in_ncases;
+	/* Number of test cases read successfully, whose stalls are sorted */
+	size_t			 in_ngood;
+	struct ingest_chunk	*in_chunks;
+	size_t			 in_nchunks;
+	size_t			 in_chunkscap;
+	/* Whether to sort the stalls of the test cases read successfully */
+	bool			 in_sort;
+	/* Account to charge allocations to */
+	struct mem_acct		*in_acct;
+	/* Failure to allocate the stalls of the first test case left without */
+	enum ac_rc		 in_alloc_rc;
+	/* Next chunk, and then test case, for a worker to pick up */
+	atomic_size_t		 in_next_chunk;
+	atomic_size_t		 in_next_case;
+	const char		*in_path;
+};
+
+static inline bool is_space(char c)
+{
+	return ' ' == c || '\t' == c || '\v' == c || '\f' == c || '\r' == c;
+}
+
+/*
+ * Parse an unsigned decimal integer the way "%lu" of sscanf(3) would, without
+ * reading past <end>. Returns a pointer past the parsed integer, or NULL if
+ * there is none.
+ */
+static const char *parse_ulong(const char *p, const char *end,
+		unsigned long int *v)
+{
+	unsigned long int x = 0;
+	bool negative = false, overflow = false;
+	const char *digits;
+
+	while (p < end && is_space(*p))
+		p++;
+
+	if (p < end && ('+' == *p || '-' == *p))
+		negative = ('-' == *p++);
+
+	for (digits = p; p < end && '0' <= *p && *p <= '9'; p++)
+	{
+		unsigned int d = (unsigned int)(*p - '0');
+
+		if (x > (ULONG_MAX - d) / 10)
+			overflow = true;
+		else
+			x = x * 10 + d;
+	}
+
+	if (digits == p)
+		return NULL;
+
+	if (true == overflow)
+		x = ULONG_MAX;
+	else if (true == negative)
+		x = -x;
+
+	*v = x;
+
+	return p;
+}
+
+/*
+ * Return the start of the line following the one at <p>, setting <eol> to the
+ * end of the latter, excluding the newline.
+ */
+static inline const char *next_line(const char *buf, size_t len,
+		const char *p, const char **eol)
+{
+	const char *next = buf + line_end(buf, len, (size_t)(p - buf));
+
+	*eol = ('\n' == next[-1]) ? next - 1 : next;
+
+	return next;
+}
+
+static enum ac_rc add_chunk(struct ingest *in, size_t off,
+		size_t ncase, size_t first, size_t nlines)
+{
+	struct ingest_chunk *ck;
+
+	if (in->in_nchunks == in->in_chunkscap)
+	{
+		size_t ncap = (0 == in->in_chunkscap) ?
+			64 : in->in_chunkscap * 2;
+		enum ac_rc ret;
+
+		ret = mem_charge(in->in_acct, ncap - in->in_chunkscap,
+				sizeof(*ck));
+		if (AC_OK != ret)
+			return ret;
+
+		ck = (struct ingest_chunk *)reallocarray(in->in_chunks, ncap,
+				sizeof(*ck));
+		if (NULL == ck)
+			return AC_OSERR;
+
+		in->in_chunks = ck;
+		in->in_chunkscap = ncap;
+	}
+
+	ck = &in->in_chunks[in->in_nchunks++];
+
+	ck->ck_off = off;
+	ck->ck_case = ncase;
+	ck->ck_first = first;
+	ck->ck_nlines = nlines;
+
+	return AC_OK;
+}
+
+/*
+ * Phase 1: find the test cases and chunk up their stall lines. Returns the
+ * failure the serial reader would run into at the header line of a test case,
+ * with <in_ncases> set to the number of test cases preceding it.
+ */
+static enum ac_rc scan(struct ingest *in, const char *p, size_t ncases)
+{
+	const char *end = in->in_buf + in->in_len;
+	size_t i, j;
+	enum ac_rc ret;
+
+	for (i = 0; i < ncases; i++)
+	{
+		struct ingest_case *ic = &in->in_cases[i];
+		const char *eol, *next, *q;
+		unsigned long int nstalls;
+
+		if (p == end)
+			return AC_DATAERR;
+
+		next = next_line(in->in_buf, in->in_len, p, &eol);
+
+		if (NULL == (q = parse_ulong(p, eol, &nstalls)) ||
+				NULL == parse_ulong(q, eol, &ic->ic_ncows))
+			return AC_DATAERR;
+
+		ic->ic_nstalls = nstalls;
+		atomic_init(&ic->ic_rc, AC_OK);
+		in->in_ncases = i + 1;
+
+		p = next;
+
+		for (j = 0; j < ic->ic_nstalls && p < end; j += INGEST_CHUNK)
+		{
+			size_t n, off = (size_t)(p - in->in_buf);
+
+			for (n = 0; n < INGEST_CHUNK && j + n < ic->ic_nstalls
+					&& p < end; n++)
+				p = next_line(in->in_buf, in->in_len, p, &eol);
+
+			ret = add_chunk(in, off, i, j, n);
+			if (AC_OK != ret)
+				return ret;
+
+			ic->ic_nlines += n;
+		}
+
+		/* Running out of input halfway through the stall lines */
+		if (ic->ic_nlines < ic->ic_nstalls)
+			return AC_OK;
+	}
+
+	return AC_OK;
+}
+
+/* Phase 2: parse a chunk of stall lines */
+static void parse_chunk(struct ingest *in, const struct ingest_chunk *ck)
+{
+	struct ingest_case *ic = &in->in_cases[ck->ck_case];
+	const char *p = in->in_buf + ck->ck_off;
+	size_t i;
+
+	if (NULL == ic->ic_stalls)
+		return;
+
+	for (i = 0; i < ck->ck_nlines; i++)
+	{
+		const char *eol, *next = next_line(in->in_buf, in->in_len, p,
+				&eol);
+
+		if (NULL == parse_ulong(p, eol,
+				&ic->ic_stalls[ck->ck_first + i]))
+		{
+			atomic_store(&ic->ic_rc, AC_DATAERR);
+
+			return;
+		}
+
+		p = next;
+	}
+}
+
+static void *parse_worker(void *arg)
+{
+	struct ingest *in = (struct ingest *)arg;
+	size_t i;
+
+	while ((i = atomic_fetch_add(&in->in_next_chunk, 1)) < in->in_nchunks)
+		parse_chunk(in, &in->in_chunks[i]);
+
+	return NULL;
+}
+
+/* Phase 3: sort the stalls of the test cases read successfully */
+static void *sort_worker(void *arg)
+{
+	struct ingest *in = (struct ingest *)arg;
+	size_t i;
+
+	while ((i = atomic_fetch_add(&in->in_next_case, 1)) < in->in_ngood)
+	{
+		struct ingest_case *ic = &in->in_cases[i];
+
+		trace_context(in->in_path, i + 1);
+		sort_stalls(ic->ic_stalls, ic->ic_nstalls, ic->ic_ncows);
+	}
+
+	return NULL;
+}
+
+/*
+ * Run a phase on up to <nworkers> threads, including the calling one. Work is
+ * handed out through a shared counter, so a thread that fails to start only
+ * leaves more of it to the others.
+ */
+static void run_phase(struct ingest *in, void *(*fn)(void *),
+		pthread_t *threads, unsigned int nworkers)
+{
+	unsigned int i, nthreads = 0;
+
+	for (i = 0; i + 1 < nworkers; i++)
+	{
+		if (0 != pthread_create(&threads[i], NULL, fn, in))
+			break;
+
+		nthreads++;
+	}
+
+	fn(in);
+
+	for (i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+}
+
+/*
+ * Settle the outcome of the test case the serial reader would have failed at,
+ * if any, and the number of test cases read successfully before it.
+ */
+static enum ac_rc settle(struct ingest *in, enum ac_rc scan_rc)
+{
+	size_t i;
+	enum ac_rc ret = AC_OK;
+
+	for (i = 0; i < in->in_ncases; i++)
+	{
+		struct ingest_case *ic = &in->in_cases[i];
+
+		if (NULL == ic->ic_stalls)
+			ret = in->in_alloc_rc;
+		else if (AC_OK != (ret = atomic_load(&ic->ic_rc)))
+			;
+		else if (ic->ic_nlines < ic->ic_nstalls)
+			ret = AC_DATAERR;
+		else
+			ret = check_test_case(ic->ic_nstalls, ic->ic_ncows);
+
+		if (AC_OK != ret)
+			break;
+	}
+
+	in->in_ngood = i;
+
+	return (i < in->in_ncases) ? ret : scan_rc;
+}
+
+enum ac_rc ingest_parallel(const char *buf, size_t len, unsigned int nworkers,
+		bool sort, struct mem_acct *ma, struct ac_test_set *ts)
+{
+	struct ingest in;
+	const char *eol, *next;
+	unsigned long int ncases;
+	pthread_t *threads = NULL;
+	size_t j;
+	enum ac_rc ret = AC_OK, scan_rc;
+
+	memset(&in, 0, sizeof(in));
+
+	in.in_buf = buf;
+	in.in_len = len;
+	in.in_path = ts->ts_inputpath;
+	in.in_sort = sort;
+	in.in_acct = ma;
+	in.in_alloc_rc = AC_OSERR;
+
+	if (0 == len)
+		return AC_DATAERR;
+
+	next = next_line(buf, len, buf, &eol);
+
+	if (NULL == parse_ulong(buf, eol, &ncases))
+		return AC_DATAERR;
+
+	/* The special case where the hobbitses try to trick us */
+	if (0 == ncases)
+	{
+		ts->ts_ntc = 0;
+
+		return AC_OK;
+	}
+
+	ret = mem_charge(ma, ncases, sizeof(struct ac_test_case));
+	if (AC_OK != ret)
+		return ret;
+
+	ts->ts_tcs = (struct ac_test_case *)calloc(ncases, sizeof(struct ac_test_case));
+	if (NULL == ts->ts_tcs)
+		return AC_OSERR;
+
+	if (AC_OK != (ret = mem_charge(ma, ncases, sizeof(*in.in_cases))))
+		return ret;
+
+	in.in_cases = (struct ingest_case *)calloc(ncases, sizeof(*in.in_cases));
+	if (NULL == in.in_cases)
+		return AC_OSERR;
+
+	scan_rc = scan(&in, next, ncases);
+	if (AC_OSERR == scan_rc || AC_NOMEM == scan_rc)
+	{
+		ret = scan_rc;
+		goto out;
+	}
+
+	/*
+	 * The serial reader allocates the stalls of a test case before reading
+	 * them, so the first failed allocation ends the test set.
+	 */
+	for (j = 0; j < in.in_ncases; j++)
+	{
+		struct ingest_case *ic = &in.in_cases[j];
+
+		if (AC_OK != (in.in_alloc_rc = mem_charge(ma, ic->ic_nstalls,
+				sizeof(unsigned long int))))
+			break;
+
+		in.in_alloc_rc = AC_OSERR;
+		ic->ic_stalls = (unsigned long int *)reallocarray(NULL,
+				ic->ic_nstalls, sizeof(unsigned long int));
+		if (NULL == ic->ic_stalls)
+			break;
+	}
+
+	atomic_init(&in.in_next_chunk, 0);
+	atomic_init(&in.in_next_case, 0);
+
+	if (nworkers > 1)
+		threads = (pthread_t *)calloc(nworkers - 1, sizeof(*threads));
+
+	/* Short of threads, the calling thread does all of the work */
+	if (NULL == threads)
+		nworkers = 1;
+
+	run_phase(&in, parse_worker, threads, nworkers);
+
+	ret = settle(&in, scan_rc);
+
+	if (true == in.in_sort)
+		run_phase(&in, sort_worker, threads, nworkers);
+
+	for (j = 0; j < in.in_ngood; j++)
+	{
+		struct ingest_case *ic = &in.in_cases[j];
+
+		ac_test_case_from_parts(ic->ic_nstalls, ic->ic_ncows,
+				ic->ic_stalls, &ts->ts_tcs[j]);
+		ic->ic_stalls = NULL;
+	}
+
+	ts->ts_ntc = in.in_ngood;
+
+out:
+	for (j = 0; j < in.in_ncases; j++)
+		free(in.in_cases[j].ic_stalls);
+
+	free(in.in_cases);
+	free(in.in_chunks);
+	free(threads);
+
+	/* Only the test set itself is left */
+	mem_release(ma, ncases, sizeof(*in.in_cases));
+	mem_release(ma, in.in_chunkscap, sizeof(*in.in_chunks));
+
+	return ret;
+}
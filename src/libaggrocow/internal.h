@@ -0,0 +1,277 @@
+/* SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2022 Juris Miščenko <jxlambda@protonmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Helpers shared between the translation units of libaggrocow.
+ */
+
+#ifndef	LIBAGGROCOW_INTERNAL_H
+#define	LIBAGGROCOW_INTERNAL_H	1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "aggrocow.h"
+
+#define	AC_HIDDEN	__attribute__((__visibility__("hidden")))
+
+/* Limits on the search of a single test case, resolved from an <ac_budget> */
+struct deadline
+{
+	/* Monotonic time, in nanoseconds, to give up at, 0 for never */
+	uint64_t		dl_at;
+	/* Number of probes to give up after, 0 for never */
+	unsigned long int	dl_nprobes;
+};
+
+/* Account of the memory taken by a test set while it is built */
+struct mem_acct
+{
+	/* Most bytes that may be taken, SIZE_MAX for no limit */
+	size_t	ma_limit;
+	/* Bytes taken currently and at most */
+	size_t	ma_used;
+	size_t	ma_peak;
+};
+
+/* Return the time of the monotonic clock, in nanoseconds */
+uint64_t monotonic_ns(void) AC_HIDDEN;
+
+/* Process a test case, searching below a known bound
+ * @tc pointer to an instance of <ac_test_case>
+ * @rbound bound on the search, no larger than the last stall index
+ * @dl pointer to the limits on the search
+ * @ma pointer to the account to charge the memory of the search to, or NULL
+ *
+ * Gives the same result as an unbounded search, provided that the result is
+ * known to lie below <rbound>.
+ */
+enum ac_rc test_case_process_bounded(struct ac_test_case *tc,
+		unsigned long int rbound, const struct deadline *dl,
+		struct mem_acct *ma) AC_HIDDEN;
+
+/* Sort the stalls of a test case in ascending order
+ * @stalls pointer to an array, of length <nstalls>, of stall indices
+ * @nstalls number of stalls in <stalls>
+ * @ncows number of cows of the test case, for tracing purposes only
+ */
+void sort_stalls(unsigned long int *stalls, size_t nstalls,
+		unsigned long int ncows) AC_HIDDEN;
+
+/* Check that a test case of the given dimensions is solvable
+ *
+ * @return <AC_EINVAL> if it is not, <AC_OK> otherwise.
+ */
+enum ac_rc check_test_case(size_t nstalls, unsigned long int ncows) AC_HIDDEN;
+
+/* Build a test set by parsing a mapped input file with worker threads
+ * @buf pointer to the contents of the input file
+ * @len length of <buf>, in bytes
+ * @nworkers number of threads to parse with, including the calling one
+ * @sort whether to sort the stalls of the test cases
+ * @ma pointer to the account to charge, or NULL
+ * @ts pointer to a cleared <ac_test_set> structure to hold the test data
+ *
+ * Builds the same test set and fails with the same return codes as reading
+ * the file serially would.
+ */
+enum ac_rc ingest_parallel(const char *buf, size_t len, unsigned int nworkers,
+		bool sort, struct mem_acct *ma,
+		struct ac_test_set *ts) AC_HIDDEN;
+
+/* Return the offset just past a line of a mapped input
+ * @buf pointer to the contents of the input
+ * @len length of <buf>, in bytes
+ * @pos offset of the first byte of the line, less than <len>
+ *
+ * A line is whatever fgets(3) would read into a buffer of BUFSIZ bytes, so a
+ * longer one is split into pieces of BUFSIZ - 1 bytes, just like the serial
+ * reader splits it.
+ */
+size_t line_end(const char *buf, size_t len, size_t pos) AC_HIDDEN;
+
+/* Read a line with a single stall index
+ * @fp the input to read from
+ * @stall pointer to store the stall index to
+ *
+ * @return <AC_DATAERR> upon a premature end of input or a malformed line,
+ *         <AC_IOERR> upon a read failure, <AC_OK> otherwise.
+ */
+enum ac_rc read_stall(FILE *fp, unsigned long int *stall) AC_HIDDEN;
+
+/* Read a test case from a file, positioned at its first line
+ * @fp the input to read from
+ * @opts pointer to the options to read it with, or NULL for the defaults
+ * @sort whether to sort the stalls of the test case
+ * @ma pointer to the account to charge, or NULL
+ * @tc pointer to an instance of <ac_test_case> to fill with test data
+ *
+ * @return just like <ac_test_set_from_path>.
+ */
+enum ac_rc test_case_from_file(FILE *fp, const struct ac_load_opts *opts,
+		bool sort, struct mem_acct *ma, struct ac_test_case *tc) AC_HIDDEN;
+
+/* Read consecutive test cases of a test set from a file
+ * @fp the input to read from, positioned at the first line of the test case
+ *     after the <first> ones, or NULL if <ncases> is 0
+ * @first number of test cases of the input before them
+ * @ncases number of test cases to read
+ * @ts pointer to a cleared <ac_test_set> structure to hold the test data
+ *
+ * @return just like <ac_test_set_from_path>.
+ */
+enum ac_rc test_cases_from_file(FILE *fp, const struct ac_load_opts *opts,
+		bool sort, struct mem_acct *ma, size_t first, size_t ncases,
+		struct ac_test_set *ts) AC_HIDDEN;
+
+/* Open the index of an input file, building it if need be
+ * @path path to the input file
+ * @ma pointer to the account to charge an index built in memory to, or NULL
+ * @ixp pointer to store the index to
+ *
+ * @return just like <ac_index_open>.
+ */
+enum ac_rc index_open(const char *path, struct mem_acct *ma,
+		struct ac_index **ixp) AC_HIDDEN;
+
+/* Return the input of an index, positioned at the first line of a test case
+ * @ix pointer to the index
+ * @i index of the test case, counting from 0
+ *
+ * @return NULL if the test case is not in the index or cannot be sought to.
+ */
+FILE *index_seek(struct ac_index *ix, size_t i) AC_HIDDEN;
+
+/* Build an out-of-core test case by reading its stalls from a file
+ * @fp the input to read the stall lines from
+ * @nstalls number of stall lines to read
+ * @ncows number of cows of the test case
+ * @opts pointer to the options holding the memory budget
+ * @ma pointer to the account to charge, or NULL
+ * @tc pointer to an instance of <ac_test_case> to fill with test data
+ *
+ * Fails just like reading the test case into memory would, except for
+ * <AC_EINVAL> if the memory budget is too small to work with and <AC_OSERR>
+ * or <AC_IOERR> upon failing to set up or write the temporary files.
+ */
+enum ac_rc ooc_test_case_from_file(FILE *fp, size_t nstalls,
+		unsigned long int ncows, const struct ac_load_opts *opts,
+		struct mem_acct *ma, struct ac_test_case *tc) AC_HIDDEN;
+
+/* Return the largest stall index of an out-of-core test case */
+unsigned long int ooc_last_stall(const struct ac_ooc *ooc) AC_HIDDEN;
+
+/* Return the memory taken by out-of-core stalls, in bytes */
+size_t ooc_nbytes(const struct ac_ooc *ooc) AC_HIDDEN;
+
+/* Allocate a buffer for the feasibility probes of an out-of-core test case
+ * @ooc pointer to the out-of-core stalls
+ * @ma pointer to the account to charge the buffer to, or NULL
+ * @buf pointer to store the buffer to, to be let go of by <ooc_buffer_free>
+ *
+ * @return <AC_NOMEM> if the buffer does not fit in <ma>,
+ *         <AC_OSERR> upon failure to allocate it,
+ *         <AC_OK> otherwise.
+ */
+enum ac_rc ooc_buffer(const struct ac_ooc *ooc, struct mem_acct *ma,
+		unsigned long int **buf) AC_HIDDEN;
+
+/* Deallocate a buffer allocated by <ooc_buffer>, releasing its charge */
+void ooc_buffer_free(const struct ac_ooc *ooc, struct mem_acct *ma,
+		unsigned long int *buf) AC_HIDDEN;
+
+/* Check whether cows can be placed at a given distance in out-of-core stalls
+ * @ooc pointer to the out-of-core stalls
+ * @buf pointer to a buffer allocated by <ooc_buffer>
+ * @ncows number of cows to place
+ * @min_distance minimum distance between any two cows
+ * @feasible pointer to store the answer to
+ *
+ * @return <AC_IOERR> upon a read failure, <AC_OK> otherwise.
+ */
+enum ac_rc ooc_can_distribute(const struct ac_ooc *ooc, unsigned long int *buf,
+		unsigned long int ncows, unsigned long int min_distance,
+		bool *feasible) AC_HIDDEN;
+
+/* Deallocate out-of-core stalls and remove their files */
+void ooc_destroy(struct ac_ooc *ooc) AC_HIDDEN;
+
+/* Deduplicate the stalls of a test set against a pool
+ * @poolp pointer to the pool, which is created if it is NULL
+ * @ts pointer to the test set
+ * @sorted whether the stalls of the test set are already sorted
+ * @ma pointer to the account to charge scratch memory to, or NULL
+ *
+ * Points every test case of <ts> with the same stalls as ones already in the
+ * pool at them, and adds the stalls of the rest to the pool. Stall lists that
+ * cannot be pooled for the lack of memory stay with their test case. The
+ * stalls of every test case are sorted afterwards.
+ */
+void pool_test_set(struct ac_stall_pool **poolp, struct ac_test_set *ts,
+		bool sorted, struct mem_acct *ma) AC_HIDDEN;
+
+/* Return the memory taken by a pool and the stalls in it, in bytes */
+size_t pool_nbytes(const struct ac_stall_pool *pool) AC_HIDDEN;
+
+/* Check whether the stalls of a test case belong to a pool */
+bool pool_owns(const struct ac_stall_pool *pool,
+		const struct ac_test_case *tc) AC_HIDDEN;
+
+/* Process every test case of a pool, batched by their stalls
+ *
+ * Processing of the test cases sharing the same stalls stops at the first
+ * one that fails, see <pool_rc>.
+ */
+void pool_process(struct ac_stall_pool *pool, const struct deadline *dl) AC_HIDDEN;
+
+/* Return the outcome of processing a test case of a pool
+ *
+ * @return the failure of the test case sharing its stalls that processing
+ *         stopped at, if <tc> was not processed because of it, <AC_OK>
+ *         otherwise.
+ */
+enum ac_rc pool_rc(const struct ac_test_case *tc) AC_HIDDEN;
+
+/* Release the pools references to its stalls and deallocate it */
+void pool_destroy(struct ac_stall_pool *pool) AC_HIDDEN;
+
+/* Drop a reference to pooled stalls, deallocating them with the last one */
+void stalls_unref(struct ac_stalls *st) AC_HIDDEN;
+
+/* Set up an empty memory account
+ * @ma pointer to the account
+ * @limit most bytes that may be charged to it, SIZE_MAX for no limit
+ */
+void mem_acct_init(struct mem_acct *ma, size_t limit) AC_HIDDEN;
+
+/* Charge an allocation of <n> members of <size> bytes to an account
+ * @ma pointer to the account, or NULL to not keep one
+ *
+ * @return <AC_NOMEM> if the charge would take the account over its limit,
+ *         <AC_OK> otherwise.
+ */
+enum ac_rc mem_charge(struct mem_acct *ma, size_t n, size_t size) AC_HIDDEN;
+
+/* Return a charge of <n> members of <size> bytes to an account */
+void mem_release(struct mem_acct *ma, size_t n, size_t size) AC_HIDDEN;
+
+/* Return the memory taken by a test set, in bytes, save for pooled stalls */
+size_t test_set_nbytes(const struct ac_test_set *ts) AC_HIDDEN;
+
+#endif /* !LIBAGGROCOW_INTERNAL_H */
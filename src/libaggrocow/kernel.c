@@ -0,0 +1,359 @@
+/* SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2022 Juris Miščenko <jxlambda@protonmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "aggrocow.h"
+#include "kernel.h"
+
+/*
+ * The vector kernels compare stall indices as 64-bit lanes, so they are only
+ * built where an unsigned long int is exactly that wide.
+ */
+#if (defined(__x86_64__) && ULONG_MAX == UINT64_MAX) && \
+	(defined(__GNUC__) || defined(__clang__))
+#define	KERNEL_X86	1
+#include <immintrin.h>
+#endif
+
+/* How far ahead of the scan, in stalls, to prefetch */
+#define	KERNEL_PREFETCH	64
+
+/*
+ * All of the kernels share the same greedy strategy: a cow is placed in the
+ * first stall, and every following cow is placed in the first stall at least
+ * <min_distance> away from the previous one. Since the stalls are sorted, that
+ * stall is the first one whose index is at least the previous index plus
+ * <min_distance>, which turns the scan into a search for the next stall
+ * crossing a threshold. The vector kernels search a whole register of stalls
+ * at a time, but only once the stall right after the previous cow is found
+ * too close: with nearly as many cows as stalls, that stall is usually the
+ * one, and setting up a search for it costs more than comparing it alone.
+ *
+ * Each of the kernels gives the same answers as the scalar one, including for
+ * a single cow, which is never considered to be placed.
+ */
+
+static bool can_distribute_scalar(const unsigned long int *stalls,
+		size_t nstalls, unsigned long int ncows,
+		unsigned long int min_distance)
+{
+	unsigned long int ncows_alloc, prev_stall, curr_stall;
+	size_t i;
+
+	/* Start by always placing a cow in the first available stall */
+	ncows_alloc = 1;
+	prev_stall = stalls[0];
+
+	for (i = 1; i < nstalls; i++)
+	{
+		curr_stall = stalls[i];
+
+		if (min_distance > curr_stall - prev_stall)
+			continue;
+
+		ncows_alloc++;
+
+		if (ncows_alloc == ncows)
+			return true;
+
+		prev_stall = curr_stall;
+	}
+
+	return false;
+}
+
+#ifdef	KERNEL_X86
+
+/* Flips the ordering of unsigned lanes into that of signed ones */
+#define	SIGN_BIT	((long long int)0x8000000000000000ULL)
+
+__attribute__((__target__("sse4.2")))
+static size_t next_stall_sse42(const unsigned long int *stalls, size_t i,
+		size_t nstalls, unsigned long int threshold)
+{
+	const __m128i sign = _mm_set1_epi64x(SIGN_BIT);
+	const __m128i t = _mm_xor_si128(_mm_set1_epi64x((long long int)threshold),
+			sign);
+
+	for (; i + 2 <= nstalls; i += 2)
+	{
+		__m128i s;
+		int below;
+
+		__builtin_prefetch(&stalls[i + KERNEL_PREFETCH]);
+
+		s = _mm_xor_si128(_mm_loadu_si128((const __m128i *)&stalls[i]),
+				sign);
+		below = _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(t, s)));
+
+		/* The stalls are sorted, so the ones below come first */
+		if (0x3 != below)
+			return i + (size_t)__builtin_popcount((unsigned int)below);
+	}
+
+	for (; i < nstalls; i++)
+		if (stalls[i] >= threshold)
+			break;
+
+	return i;
+}
+
+__attribute__((__target__("avx2")))
+static size_t next_stall_avx2(const unsigned long int *stalls, size_t i,
+		size_t nstalls, unsigned long int threshold)
+{
+	const __m256i sign = _mm256_set1_epi64x(SIGN_BIT);
+	const __m256i t = _mm256_xor_si256(
+			_mm256_set1_epi64x((long long int)threshold), sign);
+
+	for (; i + 4 <= nstalls; i += 4)
+	{
+		__m256i s;
+		int below;
+
+		__builtin_prefetch(&stalls[i + KERNEL_PREFETCH]);
+
+		s = _mm256_xor_si256(
+				_mm256_loadu_si256((const __m256i *)&stalls[i]),
+				sign);
+		below = _mm256_movemask_pd(
+				_mm256_castsi256_pd(_mm256_cmpgt_epi64(t, s)));
+
+		if (0xf != below)
+			return i + (size_t)__builtin_popcount((unsigned int)below);
+	}
+
+	for (; i < nstalls; i++)
+		if (stalls[i] >= threshold)
+			break;
+
+	return i;
+}
+
+__attribute__((__target__("avx512f")))
+static size_t next_stall_avx512(const unsigned long int *stalls, size_t i,
+		size_t nstalls, unsigned long int threshold)
+{
+	const __m512i t = _mm512_set1_epi64((long long int)threshold);
+
+	for (; i + 8 <= nstalls; i += 8)
+	{
+		__mmask8 below;
+
+		__builtin_prefetch(&stalls[i + KERNEL_PREFETCH]);
+
+		below = _mm512_cmplt_epu64_mask(_mm512_loadu_si512(&stalls[i]), t);
+
+		if (0xff != below)
+			return i + (size_t)__builtin_popcount((unsigned int)below);
+	}
+
+	for (; i < nstalls; i++)
+		if (stalls[i] >= threshold)
+			break;
+
+	return i;
+}
+
+/*
+ * Instantiates a kernel around a given next stall search. Inlining the search
+ * into the kernel lets it be compiled for the search's instruction set.
+ */
+#define	DEFINE_KERNEL(isa, target)					\
+__attribute__((__target__(target)))					\
+static bool can_distribute_##isa(const unsigned long int *stalls,	\
+		size_t nstalls, unsigned long int ncows,		\
+		unsigned long int min_distance)				\
+{									\
+	unsigned long int ncows_alloc = 1, prev_stall = stalls[0];	\
+	unsigned long int threshold;					\
+	size_t i = 1;							\
+									\
+	if (ncows < 2)							\
+		return false;						\
+									\
+	for (;;)							\
+	{								\
+		/* No stall lies that far away from the previous one */	\
+		if (prev_stall > ULONG_MAX - min_distance)		\
+			return false;					\
+									\
+		threshold = prev_stall + min_distance;			\
+									\
+		/* Search only past a next stall that is too close */	\
+		if (i < nstalls && stalls[i] < threshold)		\
+			i = next_stall_##isa(stalls, i + 1, nstalls,	\
+					threshold);			\
+		if (i == nstalls)					\
+			return false;					\
+									\
+		if (++ncows_alloc == ncows)				\
+			return true;					\
+									\
+		prev_stall = stalls[i++];				\
+	}								\
+}
+
+DEFINE_KERNEL(sse42, "sse4.2")
+DEFINE_KERNEL(avx2, "avx2")
+DEFINE_KERNEL(avx512, "avx512f")
+
+#endif /* KERNEL_X86 */
+
+struct kernel
+{
+	const char	*k_isa;
+	kernel_fn_t	 k_fn;
+	/* Whether the running CPU supports the kernel */
+	bool		(*k_supported)(void);
+};
+
+static bool supported_always(void)
+{
+	return true;
+}
+
+#ifdef	KERNEL_X86
+static bool supported_sse42(void)
+{
+	return __builtin_cpu_supports("sse4.2");
+}
+
+static bool supported_avx2(void)
+{
+	return __builtin_cpu_supports("avx2");
+}
+
+static bool supported_avx512(void)
+{
+	return __builtin_cpu_supports("avx512f");
+}
+#endif
+
+/* Known kernels, from the most preferred to the least */
+static const struct kernel kernels[] =
+{
+#ifdef	KERNEL_X86
+	{ "avx512", can_distribute_avx512, supported_avx512 },
+	{ "avx2", can_distribute_avx2, supported_avx2 },
+	{ "sse4.2", can_distribute_sse42, supported_sse42 },
+#endif
+	{ "scalar", can_distribute_scalar, supported_always },
+};
+
+/*
+ * With few cows over many stalls, most stalls lie between two placed cows and
+ * need not be looked at. Instead, the next stall crossing the threshold is
+ * bracketed by galloping ahead of the previous cow, then bisected for.
+ */
+bool kernel_can_distribute_sparse(const unsigned long int *stalls,
+		size_t nstalls, unsigned long int ncows,
+		unsigned long int min_distance)
+{
+	unsigned long int ncows_alloc, prev_stall, want;
+	size_t lo, hi, step;
+
+	ncows_alloc = 1;
+	prev_stall = stalls[0];
+	lo = 1;
+
+	while (lo < nstalls)
+	{
+		/* No stall is that far from the previous one */
+		if (prev_stall > ULONG_MAX - min_distance)
+			return false;
+
+		want = prev_stall + min_distance;
+
+		/* The stall sought lies within [lo, hi] once this is done */
+		for (step = 1, hi = lo; hi < nstalls && stalls[hi] < want;
+				step *= 2)
+		{
+			lo = hi + 1;
+			hi += step;
+		}
+
+		if (hi >= nstalls)
+			hi = nstalls;
+
+		while (lo < hi)
+		{
+			size_t m = lo + (hi - lo) / 2;
+
+			if (stalls[m] < want)
+				lo = m + 1;
+			else
+				hi = m;
+		}
+
+		if (lo == nstalls)
+			return false;
+
+		ncows_alloc++;
+
+		if (ncows_alloc == ncows)
+			return true;
+
+		prev_stall = stalls[lo++];
+	}
+
+	return false;
+}
+
+kernel_fn_t kernel_can_distribute = can_distribute_scalar;
+const char *kernel_isa = "scalar";
+
+/*
+ * Selects the kernel when the library is loaded. The AGGROCOW_KERNEL
+ * environment variable may name a kernel to use instead of the best one, which
+ * is honoured only if the CPU supports it.
+ */
+__attribute__((__constructor__))
+static void kernel_select(void)
+{
+	const char *want = getenv("AGGROCOW_KERNEL");
+	size_t i;
+
+#ifdef	KERNEL_X86
+	__builtin_cpu_init();
+#endif
+
+	for (i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++)
+	{
+		const struct kernel *k = &kernels[i];
+
+		if (NULL != want && 0 != strcmp(want, k->k_isa))
+			continue;
+
+		if (!k->k_supported())
+			continue;
+
+		kernel_can_distribute = k->k_fn;
+		kernel_isa = k->k_isa;
+
+		return;
+	}
+}
+
+const char *ac_kernel_isa(void)
+{
+	return kernel_isa;
+}
@@ -0,0 +1,55 @@
+/* SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2022 Juris Miščenko <jxlambda@protonmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Internal feasibility kernels of libaggrocow.
+ *
+ * The kernel answers whether the cows of a test case can be placed in its
+ * sorted stalls at a given minimum distance from each other. Several builds
+ * of the kernel exist, one per supported instruction set, and the best one the
+ * CPU supports is selected once, when the library is loaded.
+ */
+
+#ifndef	LIBAGGROCOW_KERNEL_H
+#define	LIBAGGROCOW_KERNEL_H	1
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "internal.h"
+
+typedef bool (*kernel_fn_t)(const unsigned long int *stalls, size_t nstalls,
+		unsigned long int ncows, unsigned long int min_distance);
+
+/*
+ * Fewer cows than one per this many stalls are placed by
+ * <kernel_can_distribute_sparse> rather than by scanning all stalls.
+ */
+#define	KERNEL_SPARSE_RATIO	128
+
+/* The feasibility kernel selected for the running CPU */
+extern kernel_fn_t kernel_can_distribute AC_HIDDEN;
+
+/* Feasibility test for few cows, looking at only some of the stalls */
+bool kernel_can_distribute_sparse(const unsigned long int *stalls,
+		size_t nstalls, unsigned long int ncows,
+		unsigned long int min_distance) AC_HIDDEN;
+
+/* Name of the instruction set of the selected kernel */
+extern const char *kernel_isa AC_HIDDEN;
+
+#endif /* !LIBAGGROCOW_KERNEL_H */
@@ -18,8 +18,16 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
 
 #include "aggrocow.h"
+#include "internal.h"
+#include "kernel.h"
+#include "trace.h"
 
 static int compar_uli(const void *a, const void *b)
 {
@@ -34,57 +42,159 @@ static int compar_uli(const void *a, const void *b)
 	return 0;
 }
 
-static bool can_distribute_cows_at_min_distance(unsigned long int *stalls, size_t nstalls,
-		unsigned long int ncows, unsigned long min_distance)
+void sort_stalls(unsigned long int *stalls, size_t nstalls,
+		unsigned long int ncows)
 {
-	unsigned long int ncows_alloc, prev_stall, curr_stall;
-	size_t i;
+	struct trace_span sp;
 
-	/* Start by always placing a cow in the first available stall */
-	ncows_alloc = 1;
-	prev_stall = stalls[0];
+	trace_begin(&sp, TRACE_SORT);
+	qsort(stalls, nstalls, sizeof(*stalls), compar_uli);
+	trace_end(&sp, nstalls, ncows);
+}
 
-	for (i = 1; i < nstalls; i++)
-	{
-		curr_stall = stalls[i];
+enum ac_rc check_test_case(size_t nstalls, unsigned long int ncows)
+{
+	if (0 == nstalls || 0 == ncows)
+		return AC_EINVAL;
 
-		if (min_distance > curr_stall - prev_stall)
-			continue;
+	if (nstalls < ncows)
+		return AC_EINVAL;
+
+	return AC_OK;
+}
 
-		ncows_alloc++;
+uint64_t monotonic_ns(void)
+{
+	struct timespec ts;
 
-		if (ncows_alloc == ncows)
-			return true;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
 
-		prev_stall = curr_stall;
-	}
+	return (uint64_t)ts.tv_sec * 1000000000U + (uint64_t)ts.tv_nsec;
+}
+
+static void deadline_from_budget(const struct ac_budget *budget,
+		struct deadline *dl)
+{
+	memset(dl, 0, sizeof(*dl));
+
+	if (NULL == budget)
+		return;
+
+	if (0 != budget->b_msec)
+		dl->dl_at = monotonic_ns() + (uint64_t)budget->b_msec * 1000000U;
 
-	return false;
+	dl->dl_nprobes = budget->b_nprobes;
 }
 
-static unsigned long int find_largest_min_cow_dist(unsigned long int *stalls, size_t nstalls,
-		unsigned long int ncows)
+static bool deadline_passed(const struct deadline *dl, unsigned long int nprobes)
+{
+	if (0 != dl->dl_nprobes && nprobes >= dl->dl_nprobes)
+		return true;
+
+	return 0 != dl->dl_at && monotonic_ns() >= dl->dl_at;
+}
+
+static enum ac_rc find_largest_min_cow_dist(const struct ac_test_case *tc,
+		unsigned long int rbound, const struct deadline *dl,
+		struct mem_acct *ma, struct ac_test_case_result *tcr)
 {
-	unsigned long int lbound, rbound, m;
+	unsigned long int lbound, m, nprobes = 0, *buf = NULL;
+	enum ac_rc ret = AC_OK;
+	bool feasible;
 
 	lbound = 0;
-	rbound = stalls[nstalls - 1];
+
+	memset(tcr, 0, sizeof(*tcr));
+
+	/*
+	 * A single cow is never considered placed, so no distance is feasible
+	 * and the result is exact without a single probe, whatever the budget.
+	 */
+	if (1 == tc->tc_ncows)
+	{
+		tcr->lmd = lbound - 1;
+		tcr->lmd_lower = tcr->lmd;
+		tcr->lmd_upper = tcr->lmd;
+
+		return AC_OK;
+	}
+
+	if (NULL != tc->tc_ooc &&
+			AC_OK != (ret = ooc_buffer(tc->tc_ooc, ma, &buf)))
+		return ret;
 
 	do
 	{
-		m = (lbound + rbound) / 2;
+		if (true == deadline_passed(dl, nprobes))
+		{
+			/*
+			 * Every distance below <lbound> is known to be feasible
+			 * and none from <rbound> on will be considered.
+			 */
+			tcr->lmd_lower = (0 == lbound) ? 0 : lbound - 1;
+			tcr->lmd_upper = (0 == rbound) ? 0 : rbound - 1;
+			tcr->lmd = tcr->lmd_lower;
+			tcr->approximate = true;
+
+			goto out;
+		}
+
+		m = lbound + (rbound - lbound) / 2;
 
-		if (true == can_distribute_cows_at_min_distance(stalls,
-				nstalls, ncows, m))
+		if (NULL != tc->tc_ooc)
+		{
+			ret = ooc_can_distribute(tc->tc_ooc, buf, tc->tc_ncows,
+					m, &feasible);
+			if (AC_OK != ret)
+				goto out;
+		}
+		else if (tc->tc_ncows < tc->tc_nstalls / KERNEL_SPARSE_RATIO)
+			feasible = kernel_can_distribute_sparse(tc->tc_stalls,
+					tc->tc_nstalls, tc->tc_ncows, m);
+		else
+			feasible = kernel_can_distribute(tc->tc_stalls,
+					tc->tc_nstalls, tc->tc_ncows, m);
+
+		if (true == feasible)
 		{
 			lbound = m + 1;
 		}
 		else
 			rbound = m;
+
+		nprobes++;
 	}
 	while (lbound < rbound);
 
-	return lbound - 1;
+	tcr->lmd = lbound - 1;
+	tcr->lmd_lower = tcr->lmd;
+	tcr->lmd_upper = tcr->lmd;
+
+out:
+	if (NULL != buf)
+		ooc_buffer_free(tc->tc_ooc, ma, buf);
+
+	return ret;
+}
+
+enum ac_rc read_stall(FILE *fp, unsigned long int *stall)
+{
+	int rc;
+	char buf[BUFSIZ];
+
+	if (NULL == fgets(buf, sizeof(buf), fp))
+	{
+		if (0 != feof(fp))
+			return AC_DATAERR;
+		else
+			return AC_IOERR;
+	}
+
+	rc = sscanf(buf, "%lu", stall);
+	if (EOF == rc || 1 != rc)
+		return AC_DATAERR;
+
+	return AC_OK;
 }
 
 static void test_case_from_parts(size_t nstalls, unsigned long int ncows,
@@ -97,11 +207,11 @@ static void test_case_from_parts(size_t nstalls, unsigned long int ncows,
 	tc->tc_stalls = stalls;
 }
 
-static enum ac_rc test_case_from_file(FILE *fp, struct ac_test_case *tc)
+/* Read the line heading a test case, with its number of stalls and cows */
+static enum ac_rc read_test_case_header(FILE *fp, size_t *nstalls,
+		unsigned long int *ncows)
 {
 	int rc;
-	enum ac_rc ret = AC_OK;
-	size_t i, nstalls, ncows, *stalls;
 	char buf[BUFSIZ];
 
 	if (NULL == fgets(buf, sizeof(buf), fp))
@@ -112,7 +222,7 @@ static enum ac_rc test_case_from_file(FILE *fp, struct ac_test_case *tc)
 			return AC_IOERR;
 	}
 
-	rc = sscanf(buf, "%zu %lu", &nstalls, &ncows);
+	rc = sscanf(buf, "%zu %lu", nstalls, ncows);
 	if (EOF == rc || 2 != rc)
 	{
 		/*
@@ -129,31 +239,66 @@ static enum ac_rc test_case_from_file(FILE *fp, struct ac_test_case *tc)
 		return AC_DATAERR;
 	}
 
-	stalls = (size_t *)reallocarray(NULL, nstalls, sizeof(size_t));
-	if (NULL == stalls)
-		return AC_OSERR;
+	return AC_OK;
+}
+
+/*
+ * Skips over a test case without parsing its stalls. A line is taken at a
+ * time, just like <read_stall> does, so the skipped test cases end exactly
+ * where reading them would have.
+ */
+static enum ac_rc skip_test_case(FILE *fp)
+{
+	enum ac_rc ret;
+	size_t i, nstalls;
+	unsigned long int ncows;
+	char buf[BUFSIZ];
 
-	memset(stalls, 0, nstalls * sizeof(size_t));
+	if (AC_OK != (ret = read_test_case_header(fp, &nstalls, &ncows)))
+		return ret;
 
 	for (i = 0; i < nstalls; i++)
 	{
 		if (NULL == fgets(buf, sizeof(buf), fp))
 		{
 			if (0 != feof(fp))
-				ret = AC_DATAERR;
+				return AC_DATAERR;
 			else
-				ret = AC_IOERR;
-
-			break;
+				return AC_IOERR;
 		}
+	}
 
-		rc = sscanf(buf, "%lu", &stalls[i]);
-		if (EOF == rc || 1 != rc)
-		{
-			ret = AC_DATAERR;	
+	return AC_OK;
+}
+
+enum ac_rc test_case_from_file(FILE *fp, const struct ac_load_opts *opts,
+		bool sort, struct mem_acct *ma, struct ac_test_case *tc)
+{
+	enum ac_rc ret = AC_OK;
+	size_t i, nstalls;
+	unsigned long int ncows, *stalls;
+
+	if (AC_OK != (ret = read_test_case_header(fp, &nstalls, &ncows)))
+		return ret;
 
+	if (NULL != opts && 0 != opts->lo_membudget &&
+			nstalls > opts->lo_membudget / sizeof(*stalls))
+		return ooc_test_case_from_file(fp, nstalls, ncows, opts, ma,
+				tc);
+
+	if (AC_OK != (ret = mem_charge(ma, nstalls, sizeof(*stalls))))
+		return ret;
+
+	stalls = (unsigned long int *)reallocarray(NULL, nstalls, sizeof(*stalls));
+	if (NULL == stalls)
+		return AC_OSERR;
+
+	memset(stalls, 0, nstalls * sizeof(*stalls));
+
+	for (i = 0; i < nstalls; i++)
+	{
+		if (AC_OK != (ret = read_stall(fp, &stalls[i])))
 			break;
-		}
 	}
 
 	if (AC_OK != ret)
@@ -163,16 +308,16 @@ static enum ac_rc test_case_from_file(FILE *fp, struct ac_test_case *tc)
 		return ret;
 	}
 
-	qsort(stalls, nstalls, sizeof(size_t), compar_uli);
+	if (true == sort)
+		sort_stalls(stalls, nstalls, ncows);
 
 	return ac_test_case_from_parts(nstalls, ncows, stalls, tc);
 }
 
-static enum ac_rc test_set_from_file(FILE *fp, struct ac_test_set *ts)
+/* Read the line heading a test set, with its number of test cases */
+static enum ac_rc read_test_set_header(FILE *fp, size_t *ncases)
 {
 	int rc;
-	enum ac_rc ret;
-	size_t i, ncases;
 	char buf[BUFSIZ];
 
 	if (NULL == fgets(buf, sizeof(buf), fp))
@@ -190,10 +335,44 @@ static enum ac_rc test_set_from_file(FILE *fp, struct ac_test_set *ts)
 			return AC_IOERR;
 	}
 
-	rc = sscanf(buf, "%zu", &ncases);
+	rc = sscanf(buf, "%zu", ncases);
 	if (EOF == rc || 1 != rc)
 		return AC_DATAERR;
 
+	return AC_OK;
+}
+
+/*
+ * Narrows the <ncases> test cases of an input down to the slice requested by
+ * <opts>, if any, returning the number of test cases in it and storing the
+ * number of those before it to <first>.
+ */
+static size_t test_set_slice(const struct ac_load_opts *opts, size_t ncases,
+		size_t *first)
+{
+	*first = 0;
+
+	if (NULL == opts)
+		return ncases;
+
+	*first = (opts->lo_first < ncases) ? opts->lo_first : ncases;
+	ncases -= *first;
+
+	if (0 != opts->lo_ncases && opts->lo_ncases < ncases)
+		ncases = opts->lo_ncases;
+
+	return ncases;
+}
+
+enum ac_rc test_cases_from_file(FILE *fp, const struct ac_load_opts *opts,
+		bool sort, struct mem_acct *ma, size_t first, size_t ncases,
+		struct ac_test_set *ts)
+{
+	enum ac_rc ret;
+	size_t i;
+
+	ts->ts_first = first;
+
 	/* The special case where the hobbitses try to trick us */
 	if (0 == ncases)
 	{
@@ -202,6 +381,10 @@ static enum ac_rc test_set_from_file(FILE *fp, struct ac_test_set *ts)
 		return AC_OK;
 	}
 
+	ret = mem_charge(ma, ncases, sizeof(struct ac_test_case));
+	if (AC_OK != ret)
+		return ret;
+
 	ts->ts_tcs = (struct ac_test_case *)calloc(ncases, sizeof(struct ac_test_case));
 	if (NULL == ts->ts_tcs)
 		return AC_OSERR;
@@ -210,7 +393,9 @@ static enum ac_rc test_set_from_file(FILE *fp, struct ac_test_set *ts)
 	{
 		struct ac_test_case *tc = &ts->ts_tcs[i];
 
-		ret = test_case_from_file(fp, tc);
+		trace_ordinal(first + i + 1);
+
+		ret = test_case_from_file(fp, opts, sort, ma, tc);
 
 		if (AC_OK != ret)
 			break;
@@ -221,6 +406,48 @@ static enum ac_rc test_set_from_file(FILE *fp, struct ac_test_set *ts)
 	return ret;
 }
 
+static enum ac_rc test_set_from_file(FILE *fp, const struct ac_load_opts *opts,
+		bool sort, struct mem_acct *ma, struct ac_test_set *ts)
+{
+	enum ac_rc ret;
+	size_t i, ncases, first;
+
+	if (AC_OK != (ret = read_test_set_header(fp, &ncases)))
+		return ret;
+
+	ncases = test_set_slice(opts, ncases, &first);
+
+	for (i = 0; 0 != ncases && i < first; i++)
+	{
+		trace_ordinal(i + 1);
+
+		if (AC_OK != (ret = skip_test_case(fp)))
+			return ret;
+	}
+
+	return test_cases_from_file(fp, opts, sort, ma, first, ncases, ts);
+}
+
+/*
+ * Reads a slice of the test cases of an indexed input, going straight to the
+ * first one. Returns <AC_FAIL> without touching <ts> if it cannot be found,
+ * leaving it to be read serially instead.
+ */
+static enum ac_rc test_set_from_index(struct ac_index *ix,
+		const struct ac_load_opts *opts, bool sort, struct mem_acct *ma,
+		struct ac_test_set *ts)
+{
+	size_t ncases, first;
+	FILE *fp = NULL;
+
+	ncases = test_set_slice(opts, ac_index_ncases(ix), &first);
+
+	if (0 != ncases && NULL == (fp = index_seek(ix, first)))
+		return AC_FAIL;
+
+	return test_cases_from_file(fp, opts, sort, ma, first, ncases, ts);
+}
+
 static enum ac_rc ctx_add_test_set(struct ac_ctx *ctx, struct ac_test_set *ts)
 {
 	struct ac_test_set *tss, *_ts;
@@ -254,10 +481,10 @@ static enum ac_rc ctx_add_test_set(struct ac_ctx *ctx, struct ac_test_set *ts)
 enum ac_rc ac_test_case_from_parts(size_t nstalls, unsigned long int ncows,
 		unsigned long int *stalls, struct ac_test_case *tc)
 {
-	if (0 == nstalls || 0 == ncows || NULL == stalls || NULL == tc)
+	if (NULL == stalls || NULL == tc)
 		return AC_EINVAL;
 
-	if (nstalls < ncows)
+	if (AC_OK != check_test_case(nstalls, ncows))
 		return AC_EINVAL;
 
 	test_case_from_parts(nstalls, ncows, stalls, tc);
@@ -265,23 +492,177 @@ enum ac_rc ac_test_case_from_parts(size_t nstalls, unsigned long int ncows,
 	return AC_OK;
 }
 
+enum ac_rc ac_test_case_from_borrowed(size_t nstalls, unsigned long int ncows,
+		const unsigned long int *stalls, enum ac_stalls_order order,
+		struct ac_test_case *tc)
+{
+	unsigned long int *scratch;
+
+	if (NULL == stalls || NULL == tc)
+		return AC_EINVAL;
+
+	if (AC_OK != check_test_case(nstalls, ncows))
+		return AC_EINVAL;
+
+	if (AC_STALLS_SORTED == order)
+	{
+		/* Never written to, as the test case does not own them */
+		test_case_from_parts(nstalls, ncows, (unsigned long int *)stalls,
+				tc);
+		tc->tc_borrowed = true;
+
+		return AC_OK;
+	}
+
+	scratch = (unsigned long int *)reallocarray(NULL, nstalls,
+			sizeof(*scratch));
+	if (NULL == scratch)
+		return AC_OSERR;
+
+	memcpy(scratch, stalls, nstalls * sizeof(*scratch));
+	sort_stalls(scratch, nstalls, ncows);
+
+	test_case_from_parts(nstalls, ncows, scratch, tc);
+
+	return AC_OK;
+}
+
 void ac_ctx_init(struct ac_ctx *ctx)
 {
 	memset(ctx, 0, sizeof(*ctx));
 }
 
+/* Return the memory a context has left to admit test sets with */
+static size_t ctx_room(const struct ac_ctx *ctx)
+{
+	if (0 == ctx->ac_membudget)
+		return SIZE_MAX;
+
+	if (ctx->ac_memused >= ctx->ac_membudget)
+		return 0;
+
+	return ctx->ac_membudget - ctx->ac_memused;
+}
+
+/*
+ * Deduplicate the stalls of the test set last added to a context, if asked
+ * to, and account for the memory it takes.
+ */
+static void ctx_admit(struct ac_ctx *ctx, bool sorted)
+{
+	struct ac_test_set *ts = &ctx->ac_tss[ctx->ac_nts - 1];
+	size_t npool = pool_nbytes(ctx->ac_pool), nts = test_set_nbytes(ts);
+	struct mem_acct ma;
+
+	/* Memory taken while pooling comes on top of the test set as read */
+	ctx->ac_memused += nts;
+	mem_acct_init(&ma, ctx_room(ctx));
+
+	if (true == ctx->ac_dedup)
+		pool_test_set(&ctx->ac_pool, ts, sorted, &ma);
+
+	if (ctx->ac_memused + ma.ma_peak > ctx->ac_mempeak)
+		ctx->ac_mempeak = ctx->ac_memused + ma.ma_peak;
+
+	ctx->ac_memused = ctx->ac_memused - nts + test_set_nbytes(ts) +
+		pool_nbytes(ctx->ac_pool) - npool;
+
+	if (ctx->ac_memused > ctx->ac_mempeak)
+		ctx->ac_mempeak = ctx->ac_memused;
+}
+
+enum ac_rc ac_ctx_trace(struct ac_ctx *ctx, const char *path)
+{
+	enum ac_rc ret;
+	char *tracepath;
+
+	if (NULL == ctx || NULL == path || 0 == strlen(path))
+		return AC_EINVAL;
+
+	if (NULL != ctx->ac_tracepath)
+		return AC_CONFIG;
+
+	if (NULL == (tracepath = strdup(path)))
+		return AC_OSERR;
+
+	if (AC_OK != (ret = trace_start()))
+	{
+		free(tracepath);
+
+		return ret;
+	}
+
+	ctx->ac_tracepath = tracepath;
+
+	return AC_OK;
+}
+
 enum ac_rc ac_ctx_add_test_set(struct ac_ctx *ctx, struct ac_test_set *ts)
 {
+	enum ac_rc ret;
+
 	if (NULL == ctx || NULL == ts)
 		return AC_EINVAL;
 
-	return ctx_add_test_set(ctx, ts);
+	if (test_set_nbytes(ts) > ctx_room(ctx))
+		return AC_NOMEM;
+
+	if (AC_OK != (ret = ctx_add_test_set(ctx, ts)))
+		return ret;
+
+	ctx_admit(ctx, true);
+
+	return AC_OK;
 }
 
-enum ac_rc ac_test_set_from_path(const char *path, struct ac_test_set *ts)
+/*
+ * Reads a regular file through a mapping with worker threads. Returns
+ * <AC_FAIL> without touching <ts> if the file cannot be read that way, leaving
+ * it to be read serially instead.
+ */
+static enum ac_rc test_set_from_mapping(const char *path,
+		unsigned int nworkers, bool sort, struct mem_acct *ma,
+		struct ac_test_set *ts)
 {
 	enum ac_rc ret;
+	struct stat st;
+	void *buf;
+	int fd;
+
+	if (-1 == (fd = open(path, O_RDONLY)))
+		return AC_NOINPUT;
+
+	if (-1 == fstat(fd, &st) || !S_ISREG(st.st_mode) || 0 == st.st_size)
+	{
+		close(fd);
+
+		return AC_FAIL;
+	}
+
+	buf = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	close(fd);
+
+	if (MAP_FAILED == buf)
+		return AC_FAIL;
+
+	ret = ingest_parallel((const char *)buf, (size_t)st.st_size,
+			nworkers, sort, ma, ts);
+
+	munmap(buf, (size_t)st.st_size);
+
+	return ret;
+}
+
+static enum ac_rc test_set_from_path(const char *path,
+		const struct ac_load_opts *opts, bool sort, struct mem_acct *ma,
+		struct ac_test_set *ts)
+{
+	enum ac_rc ret, ixrc;
 	FILE *fp;
+	struct trace_span sp;
+	struct ac_index *ix = NULL;
+	bool is_stdin;
 
 	if (NULL == path || NULL == ts)
 		return AC_EINVAL;
@@ -291,38 +672,183 @@ enum ac_rc ac_test_set_from_path(const char *path, struct ac_test_set *ts)
 
 	memset(ts, 0, sizeof(*ts));
 
+	if (AC_OK != (ret = mem_charge(ma, sizeof(*ts) + strlen(path) + 1, 1)))
+		return ret;
+
 	ts->ts_inputpath = strdup(path);
 	if (NULL == ts->ts_inputpath)
 		return AC_OSERR;
 
-	if (0 == strncmp(path, "-", strlen(path)))
-		fp = stdin;
-	else if (NULL == (fp = fopen(path, "r")))
+	is_stdin = (0 == strncmp(path, "-", strlen(path)));
+
+	trace_context(path, 0);
+	trace_begin(&sp, TRACE_TEST_SET_FROM_PATH);
+
+	ret = AC_FAIL;
+
+	/*
+	 * Only a slice past the first test case gains anything from an index.
+	 * An input that cannot be indexed is read just like it would have
+	 * been otherwise, failing the same way, but running out of memory
+	 * for the index is not glossed over.
+	 */
+	if (NULL != opts && true == opts->lo_index && !is_stdin &&
+			0 != opts->lo_first)
+	{
+		ixrc = index_open(path, ma, &ix);
+
+		if (AC_OK == ixrc)
+			ret = test_set_from_index(ix, opts, sort, ma, ts);
+		else if (AC_NOMEM == ixrc || AC_OSERR == ixrc)
+			ret = ixrc;
+	}
+
+	/*
+	 * Out-of-core test cases, and slices of the test cases, are only ever
+	 * read serially.
+	 */
+	if (AC_FAIL == ret && NULL != opts && opts->lo_nworkers > 1 &&
+			0 == opts->lo_membudget && 0 == opts->lo_first &&
+			0 == opts->lo_ncases && !is_stdin)
+		ret = test_set_from_mapping(path, opts->lo_nworkers, sort, ma,
+				ts);
+
+	if (AC_FAIL == ret)
+	{
+		if (is_stdin)
+			fp = stdin;
+		else if (NULL == (fp = fopen(path, "r")))
+			ret = AC_NOINPUT;
+
+		if (AC_NOINPUT != ret)
+		{
+			ret = test_set_from_file(fp, opts, sort, ma, ts);
+
+			if (!is_stdin)
+				fclose(fp);
+		}
+	}
+
+	ac_index_close(ix);
+
+	trace_ordinal(0);
+	trace_end(&sp, 0, 0);
+
+	return ret;
+}
+
+enum ac_rc ac_test_set_ncases(const char *path, size_t *ncases)
+{
+	enum ac_rc ret;
+	FILE *fp;
+
+	if (NULL == path || NULL == ncases)
+		return AC_EINVAL;
+
+	/* The standard input cannot be read twice */
+	if (0 == strlen(path) || 0 == strcmp(path, "-"))
+		return AC_EINVAL;
+
+	if (NULL == (fp = fopen(path, "r")))
 		return AC_NOINPUT;
 
-	ret = test_set_from_file(fp, ts);
+	ret = read_test_set_header(fp, ncases);
 
-	if (0 != strncmp(path, "-", strlen(path)))
-		fclose(fp);
+	fclose(fp);
 
 	return ret;
 }
 
-enum ac_rc ac_test_case_process(struct ac_test_case *tc)
+enum ac_rc ac_test_set_from_path(const char *path, struct ac_test_set *ts)
 {
-	if (NULL == tc)
+	return test_set_from_path(path, NULL, true, NULL, ts);
+}
+
+enum ac_rc ac_test_set_from_path_opts(const char *path,
+		const struct ac_load_opts *opts, struct ac_test_set *ts)
+{
+	return test_set_from_path(path, opts, true, NULL, ts);
+}
+
+enum ac_rc ac_ctx_add_test_set_from_path(struct ac_ctx *ctx, const char *path,
+		const struct ac_load_opts *opts)
+{
+	struct ac_test_set ts;
+	struct mem_acct ma;
+	enum ac_rc ret;
+	bool sort;
+
+	if (NULL == ctx)
 		return AC_EINVAL;
 
-	tc->tc_result.lmd = find_largest_min_cow_dist(tc->tc_stalls,
-			tc->tc_nstalls, tc->tc_ncows);
+	memset(&ts, 0, sizeof(ts));
+	mem_acct_init(&ma, ctx_room(ctx));
+
+	/* Duplicate stalls need not be sorted, so leave it to the pool */
+	sort = !ctx->ac_dedup;
+
+	ret = test_set_from_path(path, opts, sort, &ma, &ts);
+
+	/* Whatever it took while being built counts, even if it was let go */
+	if (ctx->ac_memused + ma.ma_peak > ctx->ac_mempeak)
+		ctx->ac_mempeak = ctx->ac_memused + ma.ma_peak;
+
+	if (AC_OK != ret || AC_OK != (ret = ctx_add_test_set(ctx, &ts)))
+	{
+		ac_test_set_destroy(&ts);
+
+		return ret;
+	}
+
+	ctx_admit(ctx, false);
 
 	return AC_OK;
 }
 
-enum ac_rc ac_test_set_process(struct ac_test_set *ts)
+enum ac_rc test_case_process_bounded(struct ac_test_case *tc,
+		unsigned long int rbound, const struct deadline *dl,
+		struct mem_acct *ma)
+{
+	struct trace_span sp;
+	enum ac_rc ret;
+
+	trace_begin(&sp, TRACE_TEST_CASE_PROCESS);
+
+	ret = find_largest_min_cow_dist(tc, rbound, dl, ma, &tc->tc_result);
+
+	trace_end(&sp, tc->tc_nstalls, tc->tc_ncows);
+
+	return ret;
+}
+
+static enum ac_rc test_case_process(struct ac_test_case *tc,
+		const struct deadline *dl, struct mem_acct *ma)
+{
+	if (NULL == tc)
+		return AC_EINVAL;
+
+	if (NULL != tc->tc_ooc)
+		return test_case_process_bounded(tc,
+				ooc_last_stall(tc->tc_ooc), dl, ma);
+
+	return test_case_process_bounded(tc, tc->tc_stalls[tc->tc_nstalls - 1],
+			dl, ma);
+}
+
+/*
+ * Processes a test set, except for the test cases already processed through
+ * the pool <done>, if any, charging the memory it takes to <ma>.
+ */
+static enum ac_rc test_set_process(struct ac_test_set *ts,
+		const struct ac_budget *budget, const struct ac_stall_pool *done,
+		struct mem_acct *ma)
 {
 	size_t i;
 	enum ac_rc ret = AC_OK;
+	struct deadline dl;
+
+	/* The time limit applies to the test set as a whole */
+	deadline_from_budget(budget, &dl);
 
 	ts->ts_result.ntc = ts->ts_ntc;
 
@@ -330,7 +856,14 @@ enum ac_rc ac_test_set_process(struct ac_test_set *ts)
 	{
 		struct ac_test_case *tc = &ts->ts_tcs[i];
 
-		if (AC_OK != (ret = ac_test_case_process(tc)))
+		trace_context(ts->ts_inputpath, ts->ts_first + i + 1);
+
+		if (true == pool_owns(done, tc))
+			ret = pool_rc(tc);
+		else
+			ret = test_case_process(tc, &dl, ma);
+
+		if (AC_OK != ret)
 		{
 			ts->ts_result.status = AC_STATUS_INCOMPLETE;	
 
@@ -338,6 +871,9 @@ enum ac_rc ac_test_set_process(struct ac_test_set *ts)
 		}
 
 		ts->ts_result.nptc++;
+
+		if (true == tc->tc_result.approximate)
+			ts->ts_result.napprox++;
 	}
 
 	if (AC_OK == ret)
@@ -346,28 +882,168 @@ enum ac_rc ac_test_set_process(struct ac_test_set *ts)
 	return ret;
 }
 
+enum ac_rc ac_test_case_process(struct ac_test_case *tc)
+{
+	return ac_test_case_process_budget(tc, NULL);
+}
+
+enum ac_rc ac_test_case_process_budget(struct ac_test_case *tc,
+		const struct ac_budget *budget)
+{
+	struct deadline dl;
+
+	deadline_from_budget(budget, &dl);
+
+	return test_case_process(tc, &dl, NULL);
+}
+
+enum ac_rc ac_batch_process(size_t ncases, const size_t *nstalls,
+		const unsigned long int *ncows, const unsigned long int *stalls,
+		enum ac_stalls_order order, const struct ac_budget *budget,
+		struct ac_test_case_result *results)
+{
+	unsigned long int *scratch = NULL;
+	size_t i, first = 0, nscratch = 0;
+	enum ac_rc ret = AC_OK;
+	struct deadline dl;
+
+	if (0 == ncases || NULL == nstalls || NULL == ncows ||
+			NULL == stalls || NULL == results)
+		return AC_EINVAL;
+
+	for (i = 0; i < ncases; i++)
+	{
+		if (AC_OK != check_test_case(nstalls[i], ncows[i]))
+			return AC_EINVAL;
+
+		if (nstalls[i] > nscratch)
+			nscratch = nstalls[i];
+	}
+
+	if (AC_STALLS_UNSORTED == order)
+	{
+		scratch = (unsigned long int *)reallocarray(NULL, nscratch,
+				sizeof(*scratch));
+		if (NULL == scratch)
+			return AC_OSERR;
+	}
+
+	/* The time limit applies to the batch as a whole */
+	deadline_from_budget(budget, &dl);
+
+	for (i = 0; i < ncases; i++)
+	{
+		const unsigned long int *src = &stalls[first];
+		struct ac_test_case tc;
+
+		first += nstalls[i];
+
+		if (NULL != scratch)
+		{
+			memcpy(scratch, src, nstalls[i] * sizeof(*scratch));
+			sort_stalls(scratch, nstalls[i], ncows[i]);
+
+			src = scratch;
+		}
+
+		/* Stalls of the caller are never written to */
+		test_case_from_parts(nstalls[i], ncows[i],
+				(unsigned long int *)src, &tc);
+		tc.tc_borrowed = true;
+
+		trace_context(NULL, i + 1);
+
+		if (AC_OK != (ret = test_case_process(&tc, &dl, NULL)))
+			break;
+
+		results[i] = tc.tc_result;
+	}
+
+	trace_context(NULL, 0);
+	free(scratch);
+
+	return ret;
+}
+
+enum ac_rc ac_test_set_process(struct ac_test_set *ts)
+{
+	return test_set_process(ts, NULL, NULL, NULL);
+}
+
+enum ac_rc ac_test_set_process_budget(struct ac_test_set *ts,
+		const struct ac_budget *budget)
+{
+	return test_set_process(ts, budget, NULL, NULL);
+}
+
 enum ac_rc ac_ctx_process_test_sets(struct ac_ctx *ctx)
 {
 	enum ac_rc ret = AC_OK;
+	const struct ac_stall_pool *done = NULL;
+	struct mem_acct ma;
+	struct deadline dl;
 	size_t i;
 
+	/* Memory taken while processing comes on top of the test sets */
+	mem_acct_init(&ma, ctx_room(ctx));
+
+	/*
+	 * A time limit applies to each test set as a whole, which rules out
+	 * batching test cases across test sets.
+	 */
+	if (NULL != ctx->ac_pool && 0 == ctx->ac_budget.b_msec)
+	{
+		deadline_from_budget(&ctx->ac_budget, &dl);
+		pool_process(ctx->ac_pool, &dl);
+
+		done = ctx->ac_pool;
+	}
+
 	for (i = 0; i < ctx->ac_nts; i++)
 	{
 		struct ac_test_set *ts = &ctx->ac_tss[i];
 
-		if (AC_OK != (ret = ac_test_set_process(ts)))
+		if (AC_OK != (ret = test_set_process(ts, &ctx->ac_budget, done,
+						&ma)))
 			break;
 	}
 
+	if (ctx->ac_memused + ma.ma_peak > ctx->ac_mempeak)
+		ctx->ac_mempeak = ctx->ac_memused + ma.ma_peak;
+
 	return ret;
 }
 
+void ac_ctx_clear(struct ac_ctx *ctx)
+{
+	size_t i;
+
+	if (NULL == ctx)
+		return;
+
+	for (i = 0; i < ctx->ac_nts; i++)
+		ac_test_set_destroy(&ctx->ac_tss[i]);
+
+	free(ctx->ac_tss);
+	pool_destroy(ctx->ac_pool);
+
+	ctx->ac_tss = NULL;
+	ctx->ac_nts = 0;
+	ctx->ac_pool = NULL;
+	ctx->ac_memused = 0;
+}
+
 void ac_test_case_destroy(struct ac_test_case *tc)
 {
 	if (NULL == tc)
 		return;
 
-	free(tc->tc_stalls);
+	if (NULL != tc->tc_shared)
+		stalls_unref(tc->tc_shared);
+	else if (false == tc->tc_borrowed)
+		free(tc->tc_stalls);
+
+	ooc_destroy(tc->tc_ooc);
 
 	memset(tc, 0, sizeof(*tc));
 }
@@ -390,15 +1066,19 @@ void ac_test_set_destroy(struct ac_test_set *ts)
 
 void ac_ctx_destroy(struct ac_ctx *ctx)
 {
-	size_t i;
-
 	if (NULL == ctx)
 		return;
 
-	for (i = 0; i < ctx->ac_nts; i++)
-		ac_test_set_destroy(&ctx->ac_tss[i]);
+	/*
+	 * The trace is written out before the test sets are gone, as it may
+	 * still refer to their input paths.
+	 */
+	if (NULL != ctx->ac_tracepath)
+		trace_stop(ctx->ac_tracepath);
 
-	free(ctx->ac_tss);
+	ac_ctx_clear(ctx);
+
+	free(ctx->ac_tracepath);
 
 	memset(ctx, 0, sizeof(*ctx));
 }
@@ -416,8 +1096,17 @@ void ac_ctx_process_results(struct ac_ctx *ctx)
 	for (i = 0; i < ctx->ac_nts; i++)
 	{
 		struct ac_test_set *ts = &ctx->ac_tss[i];
+		struct trace_span sp;
+		int rc;
+
+		trace_context(ts->ts_inputpath, 0);
+		trace_begin(&sp, TRACE_TEST_SET_RESULT);
 
-		if (0 != ctx->ac_ts_result_handler(ts, &ts->ts_result))
+		rc = ctx->ac_ts_result_handler(ts, &ts->ts_result);
+
+		trace_end(&sp, 0, 0);
+
+		if (0 != rc)
 			continue;
 
 		if (NULL == ctx->ac_tc_result_handler)
@@ -427,7 +1116,13 @@ void ac_ctx_process_results(struct ac_ctx *ctx)
 		{
 			struct ac_test_case *tc = &ts->ts_tcs[j];
 
-			ctx->ac_tc_result_handler(j + 1, tc, &tc->tc_result);
+			trace_ordinal(ts->ts_first + j + 1);
+			trace_begin(&sp, TRACE_TEST_CASE_RESULT);
+
+			ctx->ac_tc_result_handler(ts->ts_first + j + 1, tc,
+					&tc->tc_result);
+
+			trace_end(&sp, tc->tc_nstalls, tc->tc_ncows);
 		}
 	}
 }
@@ -462,6 +1157,9 @@ const char *ac_strrc(enum ac_rc rc)
 	case AC_OSERR:
 		ret = "System error";
 		break;
+	case AC_NOMEM:
+		ret = "Memory budget exceeded";
+		break;
 	default:
 		ret = "Unknown error";
 	}
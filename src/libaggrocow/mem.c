@@ -0,0 +1,111 @@
+/* SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2022 Juris Miščenko <jxlambda@protonmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Accounting of the memory taken by test sets.
+ *
+ * Whatever builds a test set charges each allocation to an account before
+ * making it, and the charge fails once the account would go over its limit.
+ * As all sizes are known from the headers of the input before any stalls are
+ * read, a test set that does not fit is turned away before its stalls take
+ * any memory.
+ *
+ * Once built, the memory of a test set is worked out from its contents by
+ * <test_set_nbytes>, so past the loaders, an account is only kept for the
+ * scratch memory of deduplicating and processing test sets, on top of the
+ * test sets of a context.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "internal.h"
+
+void mem_acct_init(struct mem_acct *ma, size_t limit)
+{
+	memset(ma, 0, sizeof(*ma));
+
+	ma->ma_limit = limit;
+}
+
+enum ac_rc mem_charge(struct mem_acct *ma, size_t n, size_t size)
+{
+	size_t nbytes;
+
+	if (NULL == ma)
+		return AC_OK;
+
+	/* Without a limit, leave it to the allocator to fail */
+	if (0 != size && n > SIZE_MAX / size)
+		return (SIZE_MAX == ma->ma_limit) ? AC_OK : AC_NOMEM;
+
+	nbytes = n * size;
+
+	if (nbytes > ma->ma_limit - ma->ma_used)
+	{
+		if (SIZE_MAX == ma->ma_limit)
+			nbytes = ma->ma_limit - ma->ma_used;
+		else
+			return AC_NOMEM;
+	}
+
+	ma->ma_used += nbytes;
+
+	if (ma->ma_used > ma->ma_peak)
+		ma->ma_peak = ma->ma_used;
+
+	return AC_OK;
+}
+
+void mem_release(struct mem_acct *ma, size_t n, size_t size)
+{
+	size_t nbytes = n * size;
+
+	if (NULL == ma)
+		return;
+
+	ma->ma_used -= (nbytes > ma->ma_used) ? ma->ma_used : nbytes;
+}
+
+size_t test_set_nbytes(const struct ac_test_set *ts)
+{
+	size_t i, nbytes = sizeof(*ts);
+
+	if (NULL != ts->ts_inputpath)
+		nbytes += strlen(ts->ts_inputpath) + 1;
+
+	nbytes += ts->ts_ntc * sizeof(*ts->ts_tcs);
+
+	for (i = 0; i < ts->ts_ntc; i++)
+	{
+		const struct ac_test_case *tc = &ts->ts_tcs[i];
+
+		/*
+		 * Shared stalls are the pools to account for, and borrowed
+		 * ones the callers.
+		 */
+		if (NULL != tc->tc_shared || true == tc->tc_borrowed)
+			continue;
+
+		if (NULL != tc->tc_ooc)
+			nbytes += ooc_nbytes(tc->tc_ooc);
+		else
+			nbytes += tc->tc_nstalls * sizeof(*tc->tc_stalls);
+	}
+
+	return nbytes;
+}
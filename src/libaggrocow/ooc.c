@@ -0,0 +1,556 @@
+/* SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2022 Juris Miščenko <jxlambda@protonmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Out-of-core test cases, for stall lists that do not fit in memory.
+ *
+ * The stalls are read into a buffer taking up most of the memory budget, which
+ * is sorted and written out as a run whenever it fills up. The rest of the
+ * budget is set aside for keeping track of the runs and merging them. All runs
+ * go into one temporary file, and are then merged, as many at a time as the
+ * budget allows, until a single sorted run is left. Each feasibility probe of
+ * the search is then a sequential pass over that run, read a budget's worth at
+ * a time.
+ *
+ * Temporary files are unlinked as soon as they are created, so they never
+ * outlive the process.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "internal.h"
+
+/* Smallest memory budget for out-of-core test cases, in bytes */
+#define	OOC_MIN_BUDGET	(1UL << 20)
+/* Smallest buffer for a single run while merging, in stalls */
+#define	OOC_MIN_RUNBUF	((size_t)(1U << 13))
+
+/* A sorted run of stalls within a temporary file */
+struct ooc_run
+{
+	/* Offset of the run in the file and its length, in stalls */
+	size_t	or_first;
+	size_t	or_len;
+};
+
+struct ac_ooc
+{
+	/* Temporary file with the sorted stalls */
+	int			 oc_fd;
+	size_t			 oc_nstalls;
+	/* Largest stall index */
+	unsigned long int	 oc_last;
+	/* Length of the buffer for the stalls read by each probe, in stalls */
+	size_t			 oc_buflen;
+};
+
+/* A run being merged, with a window of it buffered in memory */
+struct ooc_cursor
+{
+	struct ooc_run		 cu_run;
+	unsigned long int	*cu_buf;
+	size_t			 cu_bufcap;
+	size_t			 cu_buflen;
+	size_t			 cu_pos;
+	/* Number of stalls of the run read into the buffer so far */
+	size_t			 cu_read;
+};
+
+static enum ac_rc tmpfile_open(const char *tmpdir, int *fd)
+{
+	char path[4096];
+	int n;
+
+	if (NULL == tmpdir && NULL == (tmpdir = getenv("TMPDIR")))
+		tmpdir = "/tmp";
+
+	n = snprintf(path, sizeof(path), "%s/aggrocow.XXXXXX", tmpdir);
+	if (n < 0 || (size_t)n >= sizeof(path))
+		return AC_EINVAL;
+
+	if (-1 == (*fd = mkstemp(path)))
+		return AC_OSERR;
+
+	unlink(path);
+
+	return AC_OK;
+}
+
+static enum ac_rc pwrite_all(int fd, const unsigned long int *stalls,
+		size_t nstalls, size_t first)
+{
+	const char *p = (const char *)stalls;
+	size_t len = nstalls * sizeof(*stalls);
+	off_t off = (off_t)(first * sizeof(*stalls));
+
+	while (len > 0)
+	{
+		ssize_t n = pwrite(fd, p, len, off);
+
+		if (-1 == n && EINTR == errno)
+			continue;
+
+		if (n <= 0)
+			return AC_IOERR;
+
+		p += n;
+		len -= (size_t)n;
+		off += n;
+	}
+
+	return AC_OK;
+}
+
+static enum ac_rc pread_all(int fd, unsigned long int *stalls, size_t nstalls,
+		size_t first)
+{
+	char *p = (char *)stalls;
+	size_t len = nstalls * sizeof(*stalls);
+	off_t off = (off_t)(first * sizeof(*stalls));
+
+	while (len > 0)
+	{
+		ssize_t n = pread(fd, p, len, off);
+
+		if (-1 == n && EINTR == errno)
+			continue;
+
+		if (n <= 0)
+			return AC_IOERR;
+
+		p += n;
+		len -= (size_t)n;
+		off += n;
+	}
+
+	return AC_OK;
+}
+
+static enum ac_rc cursor_fill(int fd, struct ooc_cursor *cu)
+{
+	size_t n = cu->cu_run.or_len - cu->cu_read;
+	enum ac_rc ret;
+
+	if (n > cu->cu_bufcap)
+		n = cu->cu_bufcap;
+
+	ret = pread_all(fd, cu->cu_buf, n, cu->cu_run.or_first + cu->cu_read);
+	if (AC_OK != ret)
+		return ret;
+
+	cu->cu_read += n;
+	cu->cu_buflen = n;
+	cu->cu_pos = 0;
+
+	return AC_OK;
+}
+
+/* Restore the heap property of cursors below <i>, ordered by their head */
+static void heap_sift(struct ooc_cursor **heap, size_t n, size_t i)
+{
+	for (;;)
+	{
+		size_t l = 2 * i + 1, r = l + 1, m = i;
+
+		if (l < n && heap[l]->cu_buf[heap[l]->cu_pos] <
+				heap[m]->cu_buf[heap[m]->cu_pos])
+			m = l;
+		if (r < n && heap[r]->cu_buf[heap[r]->cu_pos] <
+				heap[m]->cu_buf[heap[m]->cu_pos])
+			m = r;
+
+		if (m == i)
+			return;
+
+		{
+			struct ooc_cursor *tmp = heap[i];
+
+			heap[i] = heap[m];
+			heap[m] = tmp;
+		}
+
+		i = m;
+	}
+}
+
+/* Memory set aside for every run, to keep track of it and merge it */
+#define	OOC_RUN_NBYTES	(sizeof(struct ooc_run) + sizeof(struct ooc_cursor) \
+		+ sizeof(struct ooc_cursor *))
+
+/*
+ * Split a memory budget for a test case of <nstalls> stalls between the
+ * buffer for its stalls and the memory set aside for the runs they are sorted
+ * into, setting <nruns> to their number. Returns the length of the buffer, in
+ * stalls, or 0 if the runs would take up more than half of the budget.
+ */
+static size_t split_budget(size_t membudget, size_t nstalls, size_t *nruns)
+{
+	size_t avail = membudget - sizeof(struct ac_ooc), need, buflen;
+
+	buflen = avail / sizeof(unsigned long int);
+
+	/* The buffer only ever shrinks, and the number of runs grows, until both fit */
+	for (;;)
+	{
+		*nruns = nstalls / buflen + ((0 != nstalls % buflen) ? 1 : 0);
+		need = *nruns * OOC_RUN_NBYTES;
+
+		if (need > avail / 2)
+			return 0;
+
+		if (need + buflen * sizeof(unsigned long int) <= avail)
+			return buflen;
+
+		buflen = (avail - need) / sizeof(unsigned long int);
+	}
+}
+
+/*
+ * Merge <nruns> runs of file <in> into one run of file <out>, starting at
+ * <first>, using <mem> for buffers and <cursors> and <heap>, of <nruns>
+ * entries each, to keep track of the runs.
+ */
+static enum ac_rc merge_runs(int in, const struct ooc_run *runs, size_t nruns,
+		int out, size_t first, unsigned long int *mem, size_t memlen,
+		struct ooc_cursor *cursors, struct ooc_cursor **heap)
+{
+	unsigned long int *obuf;
+	size_t i, n = 0, olen = 0, ocap, bufcap;
+	enum ac_rc ret;
+
+	memset(cursors, 0, nruns * sizeof(*cursors));
+
+	/* One buffer per run, and one for the output */
+	bufcap = memlen / (nruns + 1);
+	obuf = mem + nruns * bufcap;
+	ocap = bufcap;
+
+	for (i = 0; i < nruns; i++)
+	{
+		struct ooc_cursor *cu = &cursors[i];
+
+		cu->cu_run = runs[i];
+		cu->cu_buf = mem + i * bufcap;
+		cu->cu_bufcap = bufcap;
+
+		if (0 == cu->cu_run.or_len)
+			continue;
+
+		if (AC_OK != (ret = cursor_fill(in, cu)))
+			return ret;
+
+		heap[n++] = cu;
+	}
+
+	for (i = n / 2; i-- > 0;)
+		heap_sift(heap, n, i);
+
+	while (n > 0)
+	{
+		struct ooc_cursor *cu = heap[0];
+
+		obuf[olen++] = cu->cu_buf[cu->cu_pos++];
+
+		if (olen == ocap)
+		{
+			if (AC_OK != (ret = pwrite_all(out, obuf, olen, first)))
+				return ret;
+
+			first += olen;
+			olen = 0;
+		}
+
+		if (cu->cu_pos == cu->cu_buflen)
+		{
+			if (cu->cu_read == cu->cu_run.or_len)
+				heap[0] = heap[--n];
+			else if (AC_OK != (ret = cursor_fill(in, cu)))
+				return ret;
+		}
+
+		heap_sift(heap, n, 0);
+	}
+
+	return pwrite_all(out, obuf, olen, first);
+}
+
+/*
+ * Merge the runs of <*fd> until one is left, in as many passes as it takes
+ * with the given memory, leaving the file descriptor of the result in <*fd>.
+ * <cursors> and <heap> have an entry for every run.
+ */
+static enum ac_rc merge(int *fd, struct ooc_run *runs, size_t nruns,
+		unsigned long int *mem, size_t memlen,
+		struct ooc_cursor *cursors, struct ooc_cursor **heap,
+		const char *tmpdir)
+{
+	size_t fan = memlen / OOC_MIN_RUNBUF - 1;
+	enum ac_rc ret;
+
+	if (fan < 2)
+		fan = 2;
+
+	while (nruns > 1)
+	{
+		size_t i, j = 0;
+		int out;
+
+		if (AC_OK != (ret = tmpfile_open(tmpdir, &out)))
+			return ret;
+
+		for (i = 0; i < nruns; i += fan)
+		{
+			size_t k, n = (nruns - i < fan) ? nruns - i : fan;
+			struct ooc_run run = { runs[i].or_first, 0 };
+
+			for (k = 0; k < n; k++)
+				run.or_len += runs[i + k].or_len;
+
+			ret = merge_runs(*fd, &runs[i], n, out, run.or_first,
+					mem, memlen, cursors, heap);
+			if (AC_OK != ret)
+			{
+				close(out);
+
+				return ret;
+			}
+
+			runs[j++] = run;
+		}
+
+		close(*fd);
+
+		*fd = out;
+		nruns = j;
+	}
+
+	return AC_OK;
+}
+
+static enum ac_rc spill_run(int fd, unsigned long int *buf, size_t len,
+		struct ooc_run *runs, size_t *nruns, size_t first)
+{
+	sort_stalls(buf, len, 0);
+
+	runs[*nruns].or_first = first;
+	runs[*nruns].or_len = len;
+	(*nruns)++;
+
+	return pwrite_all(fd, buf, len, first);
+}
+
+enum ac_rc ooc_test_case_from_file(FILE *fp, size_t nstalls,
+		unsigned long int ncows, const struct ac_load_opts *opts,
+		struct mem_acct *ma, struct ac_test_case *tc)
+{
+	struct ac_ooc *ooc = NULL;
+	struct ooc_run *runs = NULL;
+	struct ooc_cursor *cursors = NULL, **heap = NULL;
+	unsigned long int *buf = NULL;
+	size_t i, len = 0, nruns = 0, maxruns, buflen;
+	enum ac_rc ret = AC_OK;
+	int fd = -1;
+
+	if (opts->lo_membudget < OOC_MIN_BUDGET)
+		return AC_EINVAL;
+
+	if (0 == (buflen = split_budget(opts->lo_membudget, nstalls, &maxruns)))
+		return AC_EINVAL;
+
+	/* Reading the stalls in takes up the budget as a whole */
+	if (AC_OK != (ret = mem_charge(ma, 1, opts->lo_membudget)))
+		return ret;
+
+	buf = (unsigned long int *)reallocarray(NULL, buflen, sizeof(*buf));
+	runs = (struct ooc_run *)calloc(maxruns, sizeof(*runs));
+	cursors = (struct ooc_cursor *)calloc(maxruns, sizeof(*cursors));
+	heap = (struct ooc_cursor **)calloc(maxruns, sizeof(*heap));
+	if (NULL == buf || (0 != maxruns &&
+			(NULL == runs || NULL == cursors || NULL == heap)))
+		ret = AC_OSERR;
+
+	if (AC_OK == ret)
+		ret = tmpfile_open(opts->lo_tmpdir, &fd);
+
+	for (i = 0; i < nstalls && AC_OK == ret; i++)
+	{
+		if (AC_OK != (ret = read_stall(fp, &buf[len++])))
+			break;
+
+		if (len == buflen)
+		{
+			ret = spill_run(fd, buf, len, runs, &nruns, i + 1 - len);
+			len = 0;
+		}
+	}
+
+	if (AC_OK == ret && 0 != len)
+		ret = spill_run(fd, buf, len, runs, &nruns, nstalls - len);
+
+	if (AC_OK == ret)
+		ret = check_test_case(nstalls, ncows);
+
+	if (AC_OK == ret)
+		ret = merge(&fd, runs, nruns, buf, buflen, cursors, heap,
+				opts->lo_tmpdir);
+
+	free(heap);
+	free(cursors);
+	free(runs);
+	free(buf);
+	mem_release(ma, 1, opts->lo_membudget);
+
+	if (AC_OK == ret)
+		ret = mem_charge(ma, 1, sizeof(*ooc));
+
+	if (AC_OK == ret && NULL == (ooc = (struct ac_ooc *)calloc(1, sizeof(*ooc))))
+	{
+		mem_release(ma, 1, sizeof(*ooc));
+		ret = AC_OSERR;
+	}
+
+	if (AC_OK == ret)
+	{
+		ooc->oc_fd = fd;
+		ooc->oc_nstalls = nstalls;
+		ooc->oc_buflen = buflen;
+
+		if (AC_OK != (ret = pread_all(fd, &ooc->oc_last, 1, nstalls - 1)))
+		{
+			free(ooc);
+			mem_release(ma, 1, sizeof(*ooc));
+		}
+	}
+
+	if (AC_OK != ret)
+	{
+		if (-1 != fd)
+			close(fd);
+
+		return ret;
+	}
+
+	memset(tc, 0, sizeof(*tc));
+
+	tc->tc_nstalls = nstalls;
+	tc->tc_ncows = ncows;
+	tc->tc_ooc = ooc;
+
+	return AC_OK;
+}
+
+unsigned long int ooc_last_stall(const struct ac_ooc *ooc)
+{
+	return ooc->oc_last;
+}
+
+size_t ooc_nbytes(const struct ac_ooc *ooc)
+{
+	return sizeof(*ooc);
+}
+
+/* Return the length of the buffer for the probes of a test case, in stalls */
+static size_t probe_buflen(const struct ac_ooc *ooc)
+{
+	return (ooc->oc_buflen > ooc->oc_nstalls) ?
+		ooc->oc_nstalls : ooc->oc_buflen;
+}
+
+enum ac_rc ooc_buffer(const struct ac_ooc *ooc, struct mem_acct *ma,
+		unsigned long int **buf)
+{
+	size_t n = probe_buflen(ooc);
+	enum ac_rc ret;
+
+	if (AC_OK != (ret = mem_charge(ma, n, sizeof(**buf))))
+		return ret;
+
+	*buf = (unsigned long int *)reallocarray(NULL, n, sizeof(**buf));
+	if (NULL == *buf)
+	{
+		mem_release(ma, n, sizeof(**buf));
+
+		return AC_OSERR;
+	}
+
+	return AC_OK;
+}
+
+void ooc_buffer_free(const struct ac_ooc *ooc, struct mem_acct *ma,
+		unsigned long int *buf)
+{
+	free(buf);
+	mem_release(ma, probe_buflen(ooc), sizeof(*buf));
+}
+
+enum ac_rc ooc_can_distribute(const struct ac_ooc *ooc, unsigned long int *buf,
+		unsigned long int ncows, unsigned long int min_distance,
+		bool *feasible)
+{
+	unsigned long int ncows_alloc = 1, prev_stall = 0;
+	size_t first, n, buflen, i;
+	enum ac_rc ret;
+
+	buflen = probe_buflen(ooc);
+
+	*feasible = false;
+
+	/* The same greedy placement as the in-memory kernels, a window at a time */
+	for (first = 0; first < ooc->oc_nstalls; first += n)
+	{
+		n = ooc->oc_nstalls - first;
+		if (n > buflen)
+			n = buflen;
+
+		if (AC_OK != (ret = pread_all(ooc->oc_fd, buf, n, first)))
+			return ret;
+
+		i = 0;
+
+		if (0 == first)
+			prev_stall = buf[i++];
+
+		for (; i < n; i++)
+		{
+			if (min_distance > buf[i] - prev_stall)
+				continue;
+
+			if (++ncows_alloc == ncows)
+			{
+				*feasible = true;
+
+				return AC_OK;
+			}
+
+			prev_stall = buf[i];
+		}
+	}
+
+	return AC_OK;
+}
+
+void ooc_destroy(struct ac_ooc *ooc)
+{
+	if (NULL == ooc)
+		return;
+
+	close(ooc->oc_fd);
+	free(ooc);
+}
@@ -0,0 +1,522 @@
+/* SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2022 Juris Miščenko <jxlambda@protonmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Deduplication of stall lists across test cases and test sets.
+ *
+ * A pool keeps a single sorted copy of every distinct stall list seen by a
+ * context. Stall lists are keyed by a hash of their contents that does not
+ * depend on the order of the stalls, so a list can be matched against the pool
+ * before it is sorted, and the sort of every duplicate is skipped. A match is
+ * always verified against the sorted copy.
+ *
+ * Every pooled stall list also remembers the test cases referring to it, so
+ * all of them can be solved back to back while the stalls are hot in cache.
+ */
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "internal.h"
+#include "trace.h"
+
+/* Initial number of hash buckets of a pool, must be a power of two */
+#define	POOL_NBUCKETS	64
+
+/* A test case referring to pooled stalls */
+struct pool_ref
+{
+	struct ac_test_case	*pr_tc;
+	/* Path of the test set of the test case and its ordinal, for tracing */
+	const char		*pr_path;
+	size_t			 pr_tcord;
+};
+
+struct ac_stalls
+{
+	/* Number of test cases referring to the stalls, plus one for the pool */
+	atomic_size_t		 st_refcnt;
+	unsigned long int	*st_stalls;
+	size_t			 st_nstalls;
+	uint64_t		 st_hash;
+	/* Whether no two stalls share the same index */
+	bool			 st_distinct;
+	/*
+	 * Failure to process the test case with <st_failncows> cows, leaving
+	 * it and those with more cows unprocessed
+	 */
+	enum ac_rc		 st_rc;
+	unsigned long int	 st_failncows;
+	/* Pool the stalls belong to, and the next stalls in its hash bucket */
+	struct ac_stall_pool	*st_pool;
+	struct ac_stalls	*st_next;
+	/* Test cases of the pools context referring to the stalls */
+	struct pool_ref		*st_refs;
+	size_t			 st_nrefs;
+	size_t			 st_refscap;
+};
+
+struct ac_stall_pool
+{
+	struct ac_stalls	**sp_buckets;
+	size_t			  sp_nbuckets;
+	size_t			  sp_nstalls;
+	/* Memory taken by the pool and the stalls in it, in bytes */
+	size_t			  sp_nbytes;
+};
+
+/* Finalizer of splitmix64, scattering the bits of a stall index */
+static inline uint64_t mix(uint64_t x)
+{
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ULL;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebULL;
+	x ^= x >> 31;
+
+	return x;
+}
+
+/* Hash a list of stalls, regardless of their order */
+static uint64_t hash_stalls(const unsigned long int *stalls, size_t nstalls)
+{
+	uint64_t h = mix(nstalls);
+	size_t i;
+
+	for (i = 0; i < nstalls; i++)
+		h += mix(stalls[i] + 0x9e3779b97f4a7c15ULL);
+
+	return h;
+}
+
+static bool is_distinct(const unsigned long int *stalls, size_t nstalls)
+{
+	size_t i;
+
+	for (i = 1; i < nstalls; i++)
+		if (stalls[i - 1] == stalls[i])
+			return false;
+
+	return true;
+}
+
+/*
+ * Check whether the stalls in <stalls> are a permutation of the sorted,
+ * distinct stalls of <st>, by looking each of them up exactly once.
+ */
+static bool is_permutation(const struct ac_stalls *st,
+		const unsigned long int *stalls, struct mem_acct *ma)
+{
+	unsigned char *seen;
+	bool ret = true;
+	size_t i, nseen = st->st_nstalls / 8 + 1;
+
+	if (AC_OK != mem_charge(ma, nseen, 1))
+		return false;
+
+	seen = (unsigned char *)calloc(nseen, 1);
+	if (NULL == seen)
+	{
+		mem_release(ma, nseen, 1);
+
+		return false;
+	}
+
+	for (i = 0; i < st->st_nstalls && true == ret; i++)
+	{
+		size_t lo = 0, hi = st->st_nstalls;
+
+		while (lo < hi)
+		{
+			size_t m = lo + (hi - lo) / 2;
+
+			if (st->st_stalls[m] < stalls[i])
+				lo = m + 1;
+			else
+				hi = m;
+		}
+
+		if (lo == st->st_nstalls || st->st_stalls[lo] != stalls[i] ||
+				0 != (seen[lo / 8] & (1U << (lo % 8))))
+			ret = false;
+		else
+			seen[lo / 8] |= (unsigned char)(1U << (lo % 8));
+	}
+
+	free(seen);
+	mem_release(ma, nseen, 1);
+
+	return ret;
+}
+
+/*
+ * Check whether <stalls> holds the same stalls as <st>. Sorts <stalls> if that
+ * is the only way to tell, setting <sorted>.
+ */
+static bool same_stalls(const struct ac_stalls *st, unsigned long int *stalls,
+		size_t nstalls, unsigned long int ncows, bool *sorted,
+		struct mem_acct *ma)
+{
+	if (st->st_nstalls != nstalls)
+		return false;
+
+	if (true == *sorted)
+		return 0 == memcmp(st->st_stalls, stalls, nstalls * sizeof(*stalls));
+
+	if (true == st->st_distinct)
+		return is_permutation(st, stalls, ma);
+
+	sort_stalls(stalls, nstalls, ncows);
+	*sorted = true;
+
+	return 0 == memcmp(st->st_stalls, stalls, nstalls * sizeof(*stalls));
+}
+
+static bool pool_grow(struct ac_stall_pool *pool)
+{
+	struct ac_stalls **buckets;
+	size_t i, nbuckets = pool->sp_nbuckets * 2;
+
+	buckets = (struct ac_stalls **)calloc(nbuckets, sizeof(*buckets));
+	if (NULL == buckets)
+		return false;
+
+	for (i = 0; i < pool->sp_nbuckets; i++)
+	{
+		struct ac_stalls *st, *next;
+
+		for (st = pool->sp_buckets[i]; NULL != st; st = next)
+		{
+			size_t b = st->st_hash & (nbuckets - 1);
+
+			next = st->st_next;
+			st->st_next = buckets[b];
+			buckets[b] = st;
+		}
+	}
+
+	free(pool->sp_buckets);
+
+	pool->sp_buckets = buckets;
+	pool->sp_nbytes += (nbuckets - pool->sp_nbuckets) * sizeof(*buckets);
+	pool->sp_nbuckets = nbuckets;
+
+	return true;
+}
+
+static bool add_ref(struct ac_stall_pool *pool, struct ac_stalls *st,
+		struct ac_test_case *tc, const char *path, size_t tcord)
+{
+	struct pool_ref *pr;
+
+	if (st->st_nrefs == st->st_refscap)
+	{
+		size_t ncap = (0 == st->st_refscap) ? 4 : st->st_refscap * 2;
+
+		pr = (struct pool_ref *)reallocarray(st->st_refs, ncap,
+				sizeof(*pr));
+		if (NULL == pr)
+			return false;
+
+		st->st_refs = pr;
+		pool->sp_nbytes += (ncap - st->st_refscap) * sizeof(*pr);
+		st->st_refscap = ncap;
+	}
+
+	pr = &st->st_refs[st->st_nrefs++];
+
+	pr->pr_tc = tc;
+	pr->pr_path = path;
+	pr->pr_tcord = tcord;
+
+	atomic_fetch_add(&st->st_refcnt, 1);
+
+	tc->tc_shared = st;
+
+	return true;
+}
+
+/*
+ * Pool the stalls of a test case. Upon failure the test case keeps its own
+ * stalls; either way, they end up sorted.
+ */
+static void pool_test_case(struct ac_stall_pool *pool, struct ac_test_case *tc,
+		const char *path, size_t tcord, bool sorted, struct mem_acct *ma)
+{
+	struct ac_stalls *st;
+	uint64_t h;
+	size_t b;
+
+	h = hash_stalls(tc->tc_stalls, tc->tc_nstalls);
+	b = h & (pool->sp_nbuckets - 1);
+
+	for (st = pool->sp_buckets[b]; NULL != st; st = st->st_next)
+	{
+		if (st->st_hash != h)
+			continue;
+
+		if (same_stalls(st, tc->tc_stalls, tc->tc_nstalls,
+				tc->tc_ncows, &sorted, ma))
+			break;
+	}
+
+	if (NULL != st)
+	{
+		unsigned long int *stalls = tc->tc_stalls;
+
+		if (add_ref(pool, st, tc, path, tcord))
+		{
+			tc->tc_stalls = st->st_stalls;
+			free(stalls);
+
+			return;
+		}
+
+		if (false == sorted)
+			sort_stalls(tc->tc_stalls, tc->tc_nstalls, tc->tc_ncows);
+
+		return;
+	}
+
+	if (false == sorted)
+		sort_stalls(tc->tc_stalls, tc->tc_nstalls, tc->tc_ncows);
+
+	if (pool->sp_nstalls >= pool->sp_nbuckets - pool->sp_nbuckets / 4)
+	{
+		if (pool_grow(pool))
+			b = h & (pool->sp_nbuckets - 1);
+	}
+
+	st = (struct ac_stalls *)calloc(1, sizeof(*st));
+	if (NULL == st)
+		return;
+
+	st->st_stalls = tc->tc_stalls;
+	st->st_nstalls = tc->tc_nstalls;
+	st->st_hash = h;
+	st->st_distinct = is_distinct(st->st_stalls, st->st_nstalls);
+	st->st_pool = pool;
+	atomic_init(&st->st_refcnt, 1);
+
+	if (!add_ref(pool, st, tc, path, tcord))
+	{
+		free(st);
+
+		return;
+	}
+
+	st->st_next = pool->sp_buckets[b];
+	pool->sp_buckets[b] = st;
+	pool->sp_nstalls++;
+	pool->sp_nbytes += sizeof(*st) +
+		st->st_nstalls * sizeof(*st->st_stalls);
+}
+
+void pool_test_set(struct ac_stall_pool **poolp, struct ac_test_set *ts,
+		bool sorted, struct mem_acct *ma)
+{
+	struct ac_stall_pool *pool = *poolp;
+	size_t i;
+
+	if (NULL == pool)
+	{
+		pool = (struct ac_stall_pool *)calloc(1, sizeof(*pool));
+
+		if (NULL != pool)
+		{
+			pool->sp_nbuckets = POOL_NBUCKETS;
+			pool->sp_buckets = (struct ac_stalls **)calloc(
+					pool->sp_nbuckets,
+					sizeof(*pool->sp_buckets));
+
+			if (NULL == pool->sp_buckets)
+			{
+				free(pool);
+				pool = NULL;
+			}
+			else
+				pool->sp_nbytes = sizeof(*pool) +
+					pool->sp_nbuckets *
+					sizeof(*pool->sp_buckets);
+		}
+
+		*poolp = pool;
+	}
+
+	for (i = 0; i < ts->ts_ntc; i++)
+	{
+		struct ac_test_case *tc = &ts->ts_tcs[i];
+
+		/*
+		 * Stalls on disk are neither in memory nor unsorted, and
+		 * borrowed ones are not ours to let go of.
+		 */
+		if (NULL != tc->tc_shared || NULL != tc->tc_ooc ||
+				true == tc->tc_borrowed)
+			continue;
+
+		/* Attribute the sort, if any, to the test case */
+		trace_context(ts->ts_inputpath, ts->ts_first + i + 1);
+
+		if (NULL != pool)
+			pool_test_case(pool, tc, ts->ts_inputpath,
+					ts->ts_first + i + 1, sorted, ma);
+		else if (false == sorted)
+			sort_stalls(tc->tc_stalls, tc->tc_nstalls, tc->tc_ncows);
+	}
+
+	trace_ordinal(0);
+}
+
+size_t pool_nbytes(const struct ac_stall_pool *pool)
+{
+	return (NULL == pool) ? 0 : pool->sp_nbytes;
+}
+
+bool pool_owns(const struct ac_stall_pool *pool, const struct ac_test_case *tc)
+{
+	return NULL != pool && NULL != tc->tc_shared &&
+		pool == tc->tc_shared->st_pool;
+}
+
+static int compar_ref_ncows(const void *a, const void *b)
+{
+	const struct pool_ref *x = (const struct pool_ref *)a;
+	const struct pool_ref *y = (const struct pool_ref *)b;
+
+	if (x->pr_tc->tc_ncows < y->pr_tc->tc_ncows)
+		return -1;
+	else if (x->pr_tc->tc_ncows > y->pr_tc->tc_ncows)
+		return 1;
+
+	return 0;
+}
+
+/*
+ * Solve all test cases referring to the same stalls, in order of their number
+ * of cows. The more cows, the smaller the distance between them, so the result
+ * of a test case bounds the search of the next one, and test cases with the
+ * same number of cows share their result outright.
+ */
+static void process_stalls(struct ac_stalls *st, const struct deadline *dl)
+{
+	enum ac_rc ret;
+	const struct ac_test_case_result *prev = NULL;
+	unsigned long int prev_ncows = 0;
+	size_t i;
+
+	qsort(st->st_refs, st->st_nrefs, sizeof(*st->st_refs),
+			compar_ref_ncows);
+
+	for (i = 0; i < st->st_nrefs; i++)
+	{
+		struct pool_ref *pr = &st->st_refs[i];
+		struct ac_test_case *tc = pr->pr_tc;
+		unsigned long int rbound = st->st_stalls[st->st_nstalls - 1];
+
+		if (NULL != prev && prev_ncows == tc->tc_ncows)
+		{
+			tc->tc_result = *prev;
+
+			continue;
+		}
+
+		/*
+		 * A single cow is never placed, so its result bounds
+		 * nothing.
+		 */
+		if (NULL != prev && prev_ncows > 1 && prev->lmd_upper < rbound)
+			rbound = prev->lmd_upper + 1;
+
+		trace_context(pr->pr_path, pr->pr_tcord);
+
+		ret = test_case_process_bounded(tc, rbound, dl, NULL);
+		if (AC_OK != ret)
+		{
+			st->st_rc = ret;
+			st->st_failncows = tc->tc_ncows;
+
+			break;
+		}
+
+		prev = &tc->tc_result;
+		prev_ncows = tc->tc_ncows;
+	}
+}
+
+void pool_process(struct ac_stall_pool *pool, const struct deadline *dl)
+{
+	size_t i;
+
+	if (NULL == pool)
+		return;
+
+	for (i = 0; i < pool->sp_nbuckets; i++)
+	{
+		struct ac_stalls *st;
+
+		for (st = pool->sp_buckets[i]; NULL != st; st = st->st_next)
+			process_stalls(st, dl);
+	}
+}
+
+enum ac_rc pool_rc(const struct ac_test_case *tc)
+{
+	const struct ac_stalls *st = tc->tc_shared;
+
+	if (AC_OK != st->st_rc && tc->tc_ncows >= st->st_failncows)
+		return st->st_rc;
+
+	return AC_OK;
+}
+
+void stalls_unref(struct ac_stalls *st)
+{
+	if (1 != atomic_fetch_sub(&st->st_refcnt, 1))
+		return;
+
+	free(st->st_stalls);
+	free(st->st_refs);
+	free(st);
+}
+
+void pool_destroy(struct ac_stall_pool *pool)
+{
+	size_t i;
+
+	if (NULL == pool)
+		return;
+
+	for (i = 0; i < pool->sp_nbuckets; i++)
+	{
+		struct ac_stalls *st, *next;
+
+		for (st = pool->sp_buckets[i]; NULL != st; st = next)
+		{
+			next = st->st_next;
+
+			/* The test cases referring to the stalls may outlive us */
+			st->st_pool = NULL;
+			st->st_nrefs = 0;
+			stalls_unref(st);
+		}
+	}
+
+	free(pool->sp_buckets);
+	free(pool);
+}
@@ -0,0 +1,310 @@
+/* SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2022 Juris Miščenko <jxlambda@protonmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Offline processing of range queries over a single set of stalls.
+ *
+ * Each query is turned into a test case borrowing the run of sorted stalls
+ * that falls in its range, found by bisection, so no stalls are ever copied.
+ *
+ * The queries are then ordered by the first stall of their range, their
+ * number of cows and the last stall of their range, from the widest range
+ * down. Within a run of queries starting at the same stall and placing the
+ * same number of cows, each range is contained in the one before it, whose
+ * result then bounds the search of the next one, as fewer stalls never allow
+ * for a larger distance. Queries asking the very same thing share their
+ * result outright.
+ *
+ * Nothing else is shared: queries starting at different stalls or placing a
+ * different number of cows are solved on their own, even when one range is
+ * contained in the other. With only an upper bound to go on, the search would
+ * still start from a distance of 0, so bounding it any further than the span
+ * of the range divided among the cows already does saves next to nothing.
+ *
+ * Such runs are independent of each other, and are taken up by worker threads
+ * one at a time.
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+
+#include "internal.h"
+#include "trace.h"
+
+/* A query, resolved to the stalls in its range */
+struct range_job
+{
+	struct ac_range_query	*rj_query;
+	/* Ordinal of the query, for tracing */
+	size_t			 rj_ord;
+	/* The stalls in range are [rj_first, rj_end) */
+	size_t			 rj_first;
+	size_t			 rj_end;
+};
+
+struct range
+{
+	const unsigned long int	*rg_stalls;
+	struct range_job	*rg_jobs;
+	size_t			 rg_njobs;
+	/* Start of every run of jobs, and of the one past the last one */
+	size_t			*rg_runs;
+	size_t			 rg_nruns;
+	atomic_size_t		 rg_next_run;
+};
+
+/* Return the index of the first stall not below <stall> */
+static size_t lower_bound(const unsigned long int *stalls, size_t nstalls,
+		unsigned long int stall)
+{
+	size_t lo = 0, hi = nstalls;
+
+	while (lo < hi)
+	{
+		size_t m = lo + (hi - lo) / 2;
+
+		if (stalls[m] < stall)
+			lo = m + 1;
+		else
+			hi = m;
+	}
+
+	return lo;
+}
+
+/* Return the index of the first stall above <stall> */
+static size_t upper_bound(const unsigned long int *stalls, size_t nstalls,
+		unsigned long int stall)
+{
+	size_t lo = 0, hi = nstalls;
+
+	while (lo < hi)
+	{
+		size_t m = lo + (hi - lo) / 2;
+
+		if (stalls[m] <= stall)
+			lo = m + 1;
+		else
+			hi = m;
+	}
+
+	return lo;
+}
+
+static int compar_job(const void *a, const void *b)
+{
+	const struct range_job *x = (const struct range_job *)a;
+	const struct range_job *y = (const struct range_job *)b;
+
+	if (x->rj_first != y->rj_first)
+		return (x->rj_first < y->rj_first) ? -1 : 1;
+
+	if (x->rj_query->rq_ncows != y->rj_query->rq_ncows)
+		return (x->rj_query->rq_ncows < y->rj_query->rq_ncows) ? -1 : 1;
+
+	/* Widest range first */
+	if (x->rj_end != y->rj_end)
+		return (x->rj_end > y->rj_end) ? -1 : 1;
+
+	return 0;
+}
+
+/* Solve a run of jobs with the same first stall and number of cows */
+static void process_run(const struct range *rg, size_t first, size_t end)
+{
+	const struct range_job *prev = NULL;
+	size_t i;
+
+	for (i = first; i < end; i++)
+	{
+		const struct range_job *rj = &rg->rg_jobs[i];
+		struct ac_range_query *rq = rj->rj_query;
+		const unsigned long int *stalls = &rg->rg_stalls[rj->rj_first];
+		size_t nstalls = rj->rj_end - rj->rj_first;
+		unsigned long int rbound = stalls[nstalls - 1], span;
+		struct ac_test_case tc;
+		struct deadline dl;
+
+		if (NULL != prev && prev->rj_end == rj->rj_end)
+		{
+			rq->rq_result = prev->rj_query->rq_result;
+			rq->rq_rc = AC_OK;
+
+			continue;
+		}
+
+		/*
+		 * Neither the range the cows are spread over, nor a wider
+		 * range before it, allow for a larger distance. A single cow
+		 * is never placed, so it is not bounded by either.
+		 */
+		if (rq->rq_ncows > 1)
+		{
+			span = (stalls[nstalls - 1] - stalls[0]) /
+				(rq->rq_ncows - 1);
+
+			if (span < rbound)
+				rbound = span + 1;
+
+			if (NULL != prev &&
+					prev->rj_query->rq_result.lmd_upper < rbound)
+				rbound = prev->rj_query->rq_result.lmd_upper + 1;
+		}
+
+		memset(&dl, 0, sizeof(dl));
+
+		/* Stalls of the caller are never written to */
+		if (AC_OK != (rq->rq_rc = ac_test_case_from_borrowed(nstalls,
+				rq->rq_ncows, stalls, AC_STALLS_SORTED, &tc)))
+			continue;
+
+		trace_context(NULL, rj->rj_ord);
+
+		rq->rq_rc = test_case_process_bounded(&tc, rbound, &dl, NULL);
+		rq->rq_result = tc.tc_result;
+
+		prev = rj;
+	}
+}
+
+static void *range_worker(void *arg)
+{
+	struct range *rg = (struct range *)arg;
+	size_t i;
+
+	while ((i = atomic_fetch_add(&rg->rg_next_run, 1)) < rg->rg_nruns)
+		process_run(rg, rg->rg_runs[i], rg->rg_runs[i + 1]);
+
+	trace_context(NULL, 0);
+
+	return NULL;
+}
+
+/* Resolve the queries to jobs, leaving invalid ones out */
+static void range_jobs(struct range *rg, size_t nstalls,
+		struct ac_range_query *queries, size_t nqueries)
+{
+	size_t i;
+
+	for (i = 0; i < nqueries; i++)
+	{
+		struct ac_range_query *rq = &queries[i];
+		struct range_job *rj = &rg->rg_jobs[rg->rg_njobs];
+
+		memset(&rq->rq_result, 0, sizeof(rq->rq_result));
+		rq->rq_rc = AC_EINVAL;
+
+		if (rq->rq_first > rq->rq_last)
+			continue;
+
+		rj->rj_query = rq;
+		rj->rj_ord = i + 1;
+		rj->rj_first = lower_bound(rg->rg_stalls, nstalls, rq->rq_first);
+		rj->rj_end = upper_bound(rg->rg_stalls, nstalls, rq->rq_last);
+
+		if (AC_OK != check_test_case(rj->rj_end - rj->rj_first,
+				rq->rq_ncows))
+			continue;
+
+		rg->rg_njobs++;
+	}
+}
+
+enum ac_rc ac_range_process(size_t nstalls, const unsigned long int *stalls,
+		enum ac_stalls_order order, size_t nqueries,
+		struct ac_range_query *queries, unsigned int nworkers)
+{
+	struct range rg;
+	unsigned long int *sorted = NULL;
+	pthread_t *threads = NULL;
+	unsigned int nthreads = 0;
+	enum ac_rc ret = AC_OSERR;
+	size_t i;
+
+	if (0 == nstalls || NULL == stalls || NULL == queries)
+		return AC_EINVAL;
+
+	memset(&rg, 0, sizeof(rg));
+
+	if (AC_STALLS_UNSORTED == order)
+	{
+		sorted = (unsigned long int *)reallocarray(NULL, nstalls,
+				sizeof(*sorted));
+		if (NULL == sorted)
+			return AC_OSERR;
+
+		memcpy(sorted, stalls, nstalls * sizeof(*sorted));
+		sort_stalls(sorted, nstalls, 0);
+
+		stalls = sorted;
+	}
+
+	rg.rg_stalls = stalls;
+	rg.rg_jobs = (struct range_job *)reallocarray(NULL, nqueries,
+			sizeof(*rg.rg_jobs));
+	rg.rg_runs = (size_t *)reallocarray(NULL, nqueries + 1,
+			sizeof(*rg.rg_runs));
+	if ((0 != nqueries && NULL == rg.rg_jobs) || NULL == rg.rg_runs)
+		goto out;
+
+	range_jobs(&rg, nstalls, queries, nqueries);
+
+	qsort(rg.rg_jobs, rg.rg_njobs, sizeof(*rg.rg_jobs), compar_job);
+
+	for (i = 0; i < rg.rg_njobs; i++)
+	{
+		const struct range_job *rj = &rg.rg_jobs[i];
+
+		if (0 == i || rj[-1].rj_first != rj->rj_first ||
+				rj[-1].rj_query->rq_ncows != rj->rj_query->rq_ncows)
+			rg.rg_runs[rg.rg_nruns++] = i;
+	}
+
+	rg.rg_runs[rg.rg_nruns] = rg.rg_njobs;
+	atomic_init(&rg.rg_next_run, 0);
+
+	if (nworkers > rg.rg_nruns)
+		nworkers = (unsigned int)rg.rg_nruns;
+
+	if (nworkers > 1)
+		threads = (pthread_t *)calloc(nworkers - 1, sizeof(*threads));
+
+	/* Short of threads, the calling thread does all of the work */
+	for (i = 0; NULL != threads && i + 1 < nworkers; i++)
+	{
+		if (0 != pthread_create(&threads[i], NULL, range_worker, &rg))
+			break;
+
+		nthreads++;
+	}
+
+	range_worker(&rg);
+
+	for (i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+
+	ret = AC_OK;
+
+out:
+	free(threads);
+	free(rg.rg_runs);
+	free(rg.rg_jobs);
+	free(sorted);
+
+	return ret;
+}
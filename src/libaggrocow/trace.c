@@ -0,0 +1,447 @@
+/* SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2022 Juris Miščenko <jxlambda@protonmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#elif defined(__NetBSD__)
+#include <lwp.h>
+#endif
+
+#include "trace.h"
+
+/* Number of spans kept per thread, must be a power of two */
+#define	TRACE_NEVENTS	(1U << 16)
+
+/* A finished span */
+struct trace_event
+{
+	const char	*te_name;
+	/* Interned test set path, NULL if unknown */
+	const char	*te_path;
+	uint64_t	 te_start;
+	uint64_t	 te_dur;
+	size_t		 te_tcord;
+	size_t		 te_nstalls;
+	unsigned long int te_ncows;
+};
+
+/* A test set path, interned for the lifetime of the trace */
+struct trace_str
+{
+	struct trace_str	*tst_next;
+	char			 tst_str[];
+};
+
+/* Alignment of buffers, so that no two threads write to the same cache line */
+#define	TRACE_ALIGN	64
+
+/*
+ * A per-thread ring buffer of finished spans. Buffers are never deallocated,
+ * only their spans and strings are, so that a thread may always look at its
+ * own buffer, even while tracing is being stopped.
+ */
+struct trace_buf
+{
+	/* Whether the owning thread is in the middle of writing into it */
+	atomic_bool		 tb_busy;
+	/* Whether the owning thread has exited, for another one to take over */
+	atomic_bool		 tb_orphaned;
+	/* Next buffer in the list of all buffers */
+	struct trace_buf	*tb_next;
+	/* Id of the owning thread, as given to it by the operating system */
+	long int		 tb_tid;
+	/* Number of spans ever written into the buffer */
+	atomic_size_t		 tb_head;
+	/* Test set path and case ordinal the owning thread is working on */
+	const char		*tb_path;
+	size_t			 tb_tcord;
+	/* List of strings interned by the owning thread */
+	struct trace_str	*tb_strs;
+	/* Spans of the current trace, allocated along with the first one */
+	_Atomic(struct trace_event *) tb_events;
+};
+
+atomic_bool trace_enabled;
+
+/* List of the buffers of every thread that ever recorded a span */
+static _Atomic(struct trace_buf *) trace_bufs;
+static atomic_flag trace_running = ATOMIC_FLAG_INIT;
+static uint64_t trace_epoch;
+
+/* Key to learn of the exit of a thread with a buffer */
+static pthread_once_t trace_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t trace_key;
+static bool trace_key_created;
+
+static _Thread_local struct trace_buf *tl_buf;
+
+static long int thread_id(void)
+{
+#if defined(__linux__)
+	return (long int)syscall(SYS_gettid);
+#elif defined(__OpenBSD__)
+	return (long int)getthrid();
+#elif defined(__NetBSD__)
+	return (long int)_lwp_self();
+#else
+	return (long int)(uintptr_t)pthread_self();
+#endif
+}
+
+static void orphan_buf(void *arg)
+{
+	struct trace_buf *tb = (struct trace_buf *)arg;
+
+	atomic_store_explicit(&tb->tb_orphaned, true, memory_order_release);
+}
+
+static void create_key(void)
+{
+	trace_key_created = (0 == pthread_key_create(&trace_key, orphan_buf));
+}
+
+/*
+ * Return the buffer of the calling thread, taking over one left behind by an
+ * exited thread if one holds no spans, or allocating a new one otherwise.
+ */
+static struct trace_buf *thread_buf(void)
+{
+	struct trace_buf *tb;
+	size_t size;
+
+	if (NULL != tl_buf)
+		return tl_buf;
+
+	pthread_once(&trace_key_once, create_key);
+
+	for (tb = atomic_load(&trace_bufs); NULL != tb; tb = tb->tb_next)
+	{
+		bool orphaned = true;
+
+		if (!atomic_compare_exchange_strong(&tb->tb_orphaned,
+				&orphaned, false))
+			continue;
+
+		/* Spans of the exited thread are yet to be written out */
+		if (NULL == atomic_load_explicit(&tb->tb_events,
+				memory_order_acquire))
+			break;
+
+		atomic_store_explicit(&tb->tb_orphaned, true,
+				memory_order_release);
+	}
+
+	if (NULL == tb)
+	{
+		size = (sizeof(*tb) + TRACE_ALIGN - 1) & ~(size_t)(TRACE_ALIGN - 1);
+
+		if (NULL == (tb = (struct trace_buf *)aligned_alloc(TRACE_ALIGN,
+				size)))
+			return NULL;
+
+		memset(tb, 0, sizeof(*tb));
+		atomic_init(&tb->tb_busy, false);
+		atomic_init(&tb->tb_orphaned, false);
+		atomic_init(&tb->tb_head, 0);
+		atomic_init(&tb->tb_events, NULL);
+
+		tb->tb_next = atomic_load(&trace_bufs);
+		while (!atomic_compare_exchange_weak(&trace_bufs, &tb->tb_next,
+				tb))
+			;
+	}
+
+	tb->tb_tid = thread_id();
+
+	if (trace_key_created)
+		pthread_setspecific(trace_key, tb);
+
+	tl_buf = tb;
+
+	return tb;
+}
+
+/*
+ * Announce that the calling thread is about to write into its buffer, unless
+ * tracing was stopped already. Paired with <writer_leave>, so that the spans
+ * and strings of a buffer are never deallocated from under its thread.
+ */
+static bool writer_enter(struct trace_buf *tb)
+{
+	atomic_store(&tb->tb_busy, true);
+
+	if (atomic_load(&trace_enabled))
+		return true;
+
+	atomic_store_explicit(&tb->tb_busy, false, memory_order_release);
+
+	return false;
+}
+
+static void writer_leave(struct trace_buf *tb)
+{
+	atomic_store_explicit(&tb->tb_busy, false, memory_order_release);
+}
+
+static const char *intern(struct trace_buf *tb, const char *s)
+{
+	struct trace_str *tst;
+	size_t len;
+
+	if (NULL == s)
+		return NULL;
+
+	if (NULL != tb->tb_strs && 0 == strcmp(tb->tb_strs->tst_str, s))
+		return tb->tb_strs->tst_str;
+
+	len = strlen(s);
+
+	tst = (struct trace_str *)malloc(sizeof(*tst) + len + 1);
+	if (NULL == tst)
+		return NULL;
+
+	memcpy(tst->tst_str, s, len + 1);
+
+	tst->tst_next = tb->tb_strs;
+	tb->tb_strs = tst;
+
+	return tst->tst_str;
+}
+
+void trace_span_start(struct trace_span *sp, const char *name)
+{
+	sp->sp_name = name;
+	sp->sp_start = monotonic_ns() - trace_epoch;
+}
+
+void trace_span_finish(struct trace_span *sp, size_t nstalls,
+		unsigned long int ncows)
+{
+	struct trace_buf *tb;
+	struct trace_event *events, *te;
+	size_t head;
+
+	if (NULL == (tb = thread_buf()) || !writer_enter(tb))
+		return;
+
+	events = atomic_load_explicit(&tb->tb_events, memory_order_relaxed);
+	if (NULL == events)
+	{
+		events = (struct trace_event *)calloc(TRACE_NEVENTS,
+				sizeof(*events));
+		if (NULL == events)
+		{
+			writer_leave(tb);
+			return;
+		}
+
+		atomic_store_explicit(&tb->tb_events, events,
+				memory_order_relaxed);
+	}
+
+	head = atomic_load_explicit(&tb->tb_head, memory_order_relaxed);
+	te = &events[head & (TRACE_NEVENTS - 1)];
+
+	te->te_name = sp->sp_name;
+	te->te_path = tb->tb_path;
+	te->te_start = sp->sp_start;
+	te->te_dur = monotonic_ns() - trace_epoch - sp->sp_start;
+	te->te_tcord = tb->tb_tcord;
+	te->te_nstalls = nstalls;
+	te->te_ncows = ncows;
+
+	atomic_store_explicit(&tb->tb_head, head + 1, memory_order_release);
+
+	writer_leave(tb);
+}
+
+void trace_set_context(const char *path, size_t tcord)
+{
+	struct trace_buf *tb;
+
+	if (NULL == (tb = thread_buf()) || !writer_enter(tb))
+		return;
+
+	tb->tb_path = intern(tb, path);
+	tb->tb_tcord = tcord;
+
+	writer_leave(tb);
+}
+
+void trace_set_ordinal(size_t tcord)
+{
+	struct trace_buf *tb;
+
+	if (NULL == (tb = thread_buf()) || !writer_enter(tb))
+		return;
+
+	tb->tb_tcord = tcord;
+
+	writer_leave(tb);
+}
+
+enum ac_rc trace_start(void)
+{
+	if (atomic_flag_test_and_set(&trace_running))
+		return AC_CONFIG;
+
+	trace_epoch = monotonic_ns();
+	atomic_store(&trace_enabled, true);
+
+	return AC_OK;
+}
+
+static void write_json_str(FILE *fp, const char *s)
+{
+	fputc('"', fp);
+
+	for (; '\0' != *s; s++)
+	{
+		unsigned char c = (unsigned char)*s;
+
+		if ('"' == c || '\\' == c)
+			fprintf(fp, "\\%c", c);
+		else if (c < 0x20)
+			fprintf(fp, "\\u%04x", c);
+		else
+			fputc(c, fp);
+	}
+
+	fputc('"', fp);
+}
+
+static void write_event(FILE *fp, long int pid, long int tid,
+		const struct trace_event *te)
+{
+	fprintf(fp, "{\"name\":\"%s\",\"cat\":\"aggrocow\",\"ph\":\"X\","
+			"\"ts\":%" PRIu64 ".%03" PRIu64 ","
+			"\"dur\":%" PRIu64 ".%03" PRIu64 ","
+			"\"pid\":%ld,\"tid\":%ld,\"args\":{\"path\":",
+			te->te_name,
+			te->te_start / 1000, te->te_start % 1000,
+			te->te_dur / 1000, te->te_dur % 1000,
+			pid, tid);
+
+	if (NULL != te->te_path)
+		write_json_str(fp, te->te_path);
+	else
+		fputs("null", fp);
+
+	fprintf(fp, ",\"tcord\":%zu,\"nstalls\":%zu,\"ncows\":%lu}}",
+			te->te_tcord, te->te_nstalls, te->te_ncows);
+}
+
+static enum ac_rc write_trace(const char *path, struct trace_buf *bufs)
+{
+	struct trace_buf *tb;
+	FILE *fp;
+	long int pid = (long int)getpid();
+	const char *sep = "";
+	int rc;
+
+	if (NULL == (fp = fopen(path, "w")))
+		return AC_IOERR;
+
+	fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n", fp);
+
+	for (tb = bufs; NULL != tb; tb = tb->tb_next)
+	{
+		const struct trace_event *events;
+		size_t i, head;
+
+		events = atomic_load_explicit(&tb->tb_events,
+				memory_order_relaxed);
+		if (NULL == events)
+			continue;
+
+		head = atomic_load_explicit(&tb->tb_head, memory_order_acquire);
+
+		fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\","
+				"\"pid\":%ld,\"tid\":%ld,"
+				"\"args\":{\"name\":\"aggrocow-%ld\"}}",
+				sep, pid, tb->tb_tid, tb->tb_tid);
+		sep = ",\n";
+
+		/* Only the last <TRACE_NEVENTS> spans survive in the ring */
+		i = (head > TRACE_NEVENTS) ? head - TRACE_NEVENTS : 0;
+
+		for (; i < head; i++)
+		{
+			fputs(sep, fp);
+			write_event(fp, pid, tb->tb_tid,
+					&events[i & (TRACE_NEVENTS - 1)]);
+		}
+	}
+
+	fputs("\n]}\n", fp);
+
+	rc = ferror(fp);
+
+	if (0 != fclose(fp) || 0 != rc)
+		return AC_IOERR;
+
+	return AC_OK;
+}
+
+enum ac_rc trace_stop(const char *path)
+{
+	struct trace_buf *tb, *bufs;
+	enum ac_rc ret;
+
+	atomic_store(&trace_enabled, false);
+
+	bufs = atomic_load(&trace_bufs);
+
+	/*
+	 * A thread that saw tracing enabled may still be writing into its
+	 * buffer, wait for it to be done before taking the spans.
+	 */
+	for (tb = bufs; NULL != tb; tb = tb->tb_next)
+		while (atomic_load(&tb->tb_busy))
+			sched_yield();
+
+	ret = write_trace(path, bufs);
+
+	for (tb = bufs; NULL != tb; tb = tb->tb_next)
+	{
+		struct trace_str *tst;
+
+		while (NULL != (tst = tb->tb_strs))
+		{
+			tb->tb_strs = tst->tst_next;
+			free(tst);
+		}
+
+		tb->tb_path = NULL;
+		tb->tb_tcord = 0;
+		atomic_store_explicit(&tb->tb_head, 0, memory_order_relaxed);
+
+		/* Last, as a buffer without spans may be taken over */
+		free(atomic_exchange_explicit(&tb->tb_events, NULL,
+				memory_order_release));
+	}
+
+	atomic_flag_clear(&trace_running);
+
+	return ret;
+}
@@ -0,0 +1,114 @@
+/* SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2022 Juris Miščenko <jxlambda@protonmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Internal tracing facility of libaggrocow.
+ *
+ * Spans are recorded as Chrome trace-event "complete" events into per-thread
+ * ring buffers. A thread only ever writes into its own buffer, so recording a
+ * span takes no locks; buffers are published to the writer through an atomic
+ * list, and each one flags its thread as busy writing into it for
+ * <trace_stop> to wait on. When tracing is disabled, beginning and ending a
+ * span costs a single relaxed atomic load each.
+ */
+
+#ifndef	LIBAGGROCOW_TRACE_H
+#define	LIBAGGROCOW_TRACE_H	1
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "aggrocow.h"
+#include "internal.h"
+
+/* Names of the traced spans */
+#define	TRACE_TEST_SET_FROM_PATH	"ac_test_set_from_path"
+#define	TRACE_SORT			"sort"
+#define	TRACE_TEST_CASE_PROCESS		"ac_test_case_process"
+#define	TRACE_TEST_SET_RESULT		"test_set_result_handler"
+#define	TRACE_TEST_CASE_RESULT		"test_case_result_handler"
+
+/* An in-flight span, living on the stack of the traced function */
+struct trace_span
+{
+	/* Name of the span, NULL if tracing was disabled at its start */
+	const char	*sp_name;
+	/* Start of the span, in nanoseconds since the start of tracing */
+	uint64_t	 sp_start;
+};
+
+extern atomic_bool trace_enabled AC_HIDDEN;
+
+void trace_span_start(struct trace_span *sp, const char *name) AC_HIDDEN;
+void trace_span_finish(struct trace_span *sp, size_t nstalls,
+		unsigned long int ncows) AC_HIDDEN;
+void trace_set_context(const char *path, size_t tcord) AC_HIDDEN;
+void trace_set_ordinal(size_t tcord) AC_HIDDEN;
+
+/* Start tracing, recording spans of every thread until <trace_stop>
+ *
+ * @return <AC_CONFIG> if tracing is already running, <AC_OK> otherwise.
+ */
+enum ac_rc trace_start(void) AC_HIDDEN;
+
+/* Stop tracing and write out the recorded spans
+ * @path path to the file to write the Chrome trace-event JSON to
+ *
+ * Waits for threads still writing into their buffers to be done with them,
+ * then deallocates the spans of every thread, regardless of whether they could
+ * be written out. The buffers themselves are kept for the next trace, and
+ * those of exited threads are taken over by new ones.
+ *
+ * @return <AC_IOERR> if <path> cannot be opened for writing or upon a write
+ *         failure, <AC_OK> otherwise.
+ */
+enum ac_rc trace_stop(const char *path) AC_HIDDEN;
+
+/* Begin a span named <name> */
+static inline void trace_begin(struct trace_span *sp, const char *name)
+{
+	sp->sp_name = NULL;
+
+	if (atomic_load_explicit(&trace_enabled, memory_order_relaxed))
+		trace_span_start(sp, name);
+}
+
+/* End a span, annotating it with the dimensions of the case at hand */
+static inline void trace_end(struct trace_span *sp, size_t nstalls,
+		unsigned long int ncows)
+{
+	if (NULL != sp->sp_name)
+		trace_span_finish(sp, nstalls, ncows);
+}
+
+/* Set the test set path and case ordinal the calling thread is working on */
+static inline void trace_context(const char *path, size_t tcord)
+{
+	if (atomic_load_explicit(&trace_enabled, memory_order_relaxed))
+		trace_set_context(path, tcord);
+}
+
+/* Set the case ordinal the calling thread is working on */
+static inline void trace_ordinal(size_t tcord)
+{
+	if (atomic_load_explicit(&trace_enabled, memory_order_relaxed))
+		trace_set_ordinal(tcord);
+}
+
+#endif /* !LIBAGGROCOW_TRACE_H */
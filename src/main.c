@@ -23,6 +23,8 @@
 
 #include <aggrocow.h>
 
+#include "shard.h"
+
 #define	PROGNAME	"aggrcow"
 
 static void usage(int) __attribute__((__noreturn__));
@@ -33,17 +35,41 @@ static int test_set_result_handler(struct ac_test_set *ts, struct ac_test_set_re
 static int verbose_test_case_result_handler(size_t tcord, struct ac_test_case *tc,
 		struct ac_test_case_result *tcr);
 static int verbose_test_set_result_handler(struct ac_test_set *ts, struct ac_test_set_result *tsr);
+static enum ac_rc process(struct ac_ctx *ctx);
 
 int main(int argc, char *argv[])
 {
 	int ret = EXIT_SUCCESS;
 	int i, opt;
-	bool verbose = false;
+	bool verbose = false, loaded = true, sharded = false, merge = false;
 	enum ac_rc rc = AC_OK;
 	struct ac_ctx ctx;
-	const char *optstring = "hVv";
+	const char *optstring = "hVvt:j:d:Dm:T:M:s:gx";
+	const struct option longopts[] =
+	{
+		{ "help",	no_argument,		NULL,	'h' },
+		{ "version",	no_argument,		NULL,	'V' },
+		{ "verbose",	no_argument,		NULL,	'v' },
+		{ "trace",	required_argument,	NULL,	't' },
+		{ "jobs",	required_argument,	NULL,	'j' },
+		{ "deadline",	required_argument,	NULL,	'd' },
+		{ "dedup",	no_argument,		NULL,	'D' },
+		{ "membudget",	required_argument,	NULL,	'm' },
+		{ "tmpdir",	required_argument,	NULL,	'T' },
+		{ "memlimit",	required_argument,	NULL,	'M' },
+		{ "shard",	required_argument,	NULL,	's' },
+		{ "merge",	no_argument,		NULL,	'g' },
+		{ "index",	no_argument,		NULL,	'x' },
+		{ NULL,		0,			NULL,	0 }
+	};
+	const char *tracepath = NULL;
+	struct ac_load_opts opts;
+	char *end;
+
+	memset(&opts, 0, sizeof(opts));
+	ac_ctx_init(&ctx);
 
-	while (EOF != (opt = getopt(argc, argv, optstring)))
+	while (EOF != (opt = getopt_long(argc, argv, optstring, longopts, NULL)))
 	{
 		switch (opt)
 		{
@@ -54,6 +80,46 @@ int main(int argc, char *argv[])
 		case 'v':
 			verbose = true;
 			break;
+		case 't':
+			tracepath = optarg;
+			break;
+		case 'j':
+			opts.lo_nworkers = (unsigned int)strtoul(optarg, &end, 10);
+			if ('\0' == *optarg || '\0' != *end)
+				usage(EX_USAGE);
+			break;
+		case 'd':
+			ctx.ac_budget.b_msec = strtoul(optarg, &end, 10);
+			if ('\0' == *optarg || '\0' != *end)
+				usage(EX_USAGE);
+			break;
+		case 'D':
+			ctx.ac_dedup = true;
+			break;
+		case 'm':
+			opts.lo_membudget = (size_t)strtoull(optarg, &end, 10);
+			if ('\0' == *optarg || '\0' != *end)
+				usage(EX_USAGE);
+			break;
+		case 'T':
+			opts.lo_tmpdir = optarg;
+			break;
+		case 'M':
+			ctx.ac_membudget = (size_t)strtoull(optarg, &end, 10);
+			if ('\0' == *optarg || '\0' != *end)
+				usage(EX_USAGE);
+			break;
+		case 's':
+			if (false == shard_parse(optarg))
+				usage(EX_USAGE);
+			sharded = true;
+			break;
+		case 'g':
+			merge = true;
+			break;
+		case 'x':
+			opts.lo_index = true;
+			break;
 		default:
 			usage(EX_USAGE);
 		}
@@ -62,57 +128,110 @@ int main(int argc, char *argv[])
 	argc -= optind;
 	argv += optind;
 
-	if (0 == argc)
+	if (0 == argc || (true == sharded && true == merge))
 		usage(EX_USAGE);
 
-	ac_ctx_init(&ctx);
-
 	do
 	{
+		if (NULL != tracepath &&
+				AC_OK != (rc = ac_ctx_trace(&ctx, tracepath)))
+		{
+			fprintf(stderr, "Failed to enable tracing to '%s': %s\n",
+					tracepath, ac_strrc(rc));
+			ret = EXIT_FAILURE;
+			break;
+		}
+
+		if (true == verbose)
+		{
+			ctx.ac_tc_result_handler = verbose_test_case_result_handler;
+			ctx.ac_ts_result_handler = verbose_test_set_result_handler;
+		}
+		else
+		{
+			ctx.ac_tc_result_handler = test_case_result_handler;
+			ctx.ac_ts_result_handler = test_set_result_handler;
+		}
+
+		if (true == merge)
+		{
+			if (AC_OK != shard_merge(&ctx, argc, argv))
+				ret = EXIT_FAILURE;
+
+			ac_ctx_destroy(&ctx);
+			break;
+		}
+
+		/* A shard writes its results out for merging instead */
+		if (true == sharded)
+		{
+			if (AC_OK != (rc = shard_scan(argc, argv)))
+			{
+				fprintf(stderr, "Failed to scan inputs: %s\n",
+						ac_strrc(rc));
+				ret = EXIT_FAILURE;
+				break;
+			}
+
+			ctx.ac_tc_result_handler = shard_test_case_result_handler;
+			ctx.ac_ts_result_handler = shard_test_set_result_handler;
+		}
+
 		for (i = 0; i < argc; i++)
 		{
 			const char *path = argv[i];
-			struct ac_test_set ts;
 
-			memset(&ts, 0, sizeof(ts));
+			if (false == sharded ||
+					AC_OK == (rc = shard_slice(i, &opts)))
+				rc = ac_ctx_add_test_set_from_path(&ctx, path,
+						&opts);
 
-			rc = ac_test_set_from_path(path, &ts);
-			if (AC_OK != rc)
+			/*
+			 * Defer a test set that does not fit until the ones
+			 * before it are done with.
+			 */
+			if (AC_NOMEM == rc && 0 != ctx.ac_nts)
 			{
-				fprintf(stderr, "Failed to build test set from input '%s': %s\n",
-						path, ac_strrc(rc));
-				break;
+				if (AC_OK != (rc = process(&ctx)))
+					break;
+
+				ac_ctx_clear(&ctx);
+				i--;
+
+				continue;
 			}
 
-			rc = ac_ctx_add_test_set(&ctx, &ts);
 			if (AC_OK != rc)
 			{
-				fprintf(stderr, "Failed to add test set from input '%s': %s\n",
+				fprintf(stderr, "Failed to build test set from input '%s': %s\n",
 						path, ac_strrc(rc));
+				loaded = false;
+
+				if (true == sharded)
+					shard_failed(i, rc);
+
 				break;
 			}
+
+			if (true == sharded)
+				shard_loaded(i);
 		}
 
-		if (AC_OK != rc)
-			break;
+		if (true == loaded && AC_OK == rc)
+			rc = process(&ctx);
 
-		if (true == verbose)
+		if (true == sharded)
 		{
-			ctx.ac_tc_result_handler = verbose_test_case_result_handler;
-			ctx.ac_ts_result_handler = verbose_test_set_result_handler;
+			if (AC_OK != shard_finish())
+				ret = EXIT_FAILURE;
 		}
-		else
-		{
-			ctx.ac_tc_result_handler = test_case_result_handler;
-			ctx.ac_ts_result_handler = test_set_result_handler;
-		}
-
-		rc = ac_ctx_process_test_sets(&ctx);
+		else if (true == loaded && true == verbose &&
+				0 != ctx.ac_membudget)
+			printf("[*] Peak memory [bytes]: [%zu]\n", ctx.ac_mempeak);
 
-		ac_ctx_process_results(&ctx);
 		ac_ctx_destroy(&ctx);
 
-		if (AC_OK != rc)
+		if (true == loaded && AC_OK != rc)
 			ret = EXIT_FAILURE;
 	}
 	while (false);
@@ -127,7 +246,9 @@ static void usage(int ret)
 	if (EXIT_SUCCESS != ret)
 		_output = stderr;
 
-	fprintf(_output, "usage: %s [-h|-V] | [-v] FILE [FILE [..]]\n", PROGNAME);
+	fprintf(_output, "usage: %s [-h|-V] | [-v] [-D] [-j NWORKERS] [-d MSEC] [-m BYTES [-T TMPDIR]] [-M BYTES] [-x] [-s INDEX/COUNT] [-t TRACEFILE] FILE [FILE [..]]\n"
+			"       %s [-v] [-t TRACEFILE] -g SHARDFILE [SHARDFILE [..]]\n",
+			PROGNAME, PROGNAME);
 
 	exit(ret);
 }
@@ -137,6 +258,17 @@ static void version(void)
 	exit(EXIT_SUCCESS);
 }
 
+static enum ac_rc process(struct ac_ctx *ctx)
+{
+	enum ac_rc rc;
+
+	rc = ac_ctx_process_test_sets(ctx);
+
+	ac_ctx_process_results(ctx);
+
+	return rc;
+}
+
 static int test_set_result_handler(struct ac_test_set *ts __attribute__((unused)),
 		struct ac_test_set_result *tsr __attribute__((unused)))
 {
@@ -147,6 +279,9 @@ static int test_case_result_handler(size_t tcord __attribute__((unused)),
 		struct ac_test_case *tc __attribute__((unused)),
 		struct ac_test_case_result *tcr)
 {
+	if (true == tcr->approximate)
+		return printf("[%lu, %lu]\n", tcr->lmd_lower, tcr->lmd_upper);
+
 	return printf("%ld\n", tcr->lmd);
 }
 
@@ -163,6 +298,9 @@ static int verbose_test_set_result_handler(struct ac_test_set *ts,
 			source,
 			tsr->ntc, tsr->nptc);
 
+	if (0 != tsr->napprox)
+		printf("[*] Test cases approximated: [%zu]\n", tsr->napprox);
+
 	return 0;
 }
 
@@ -170,7 +308,11 @@ static int verbose_test_case_result_handler(size_t tcord,
 		struct ac_test_case *tc __attribute__((unused)),
 		struct ac_test_case_result *tcr)
 {
-	printf("%5zu) Largest Minimum Distance: %ld\n", tcord, tcr->lmd);
+	if (true == tcr->approximate)
+		printf("%5zu) Largest Minimum Distance: [%lu, %lu] (approximate)\n",
+				tcord, tcr->lmd_lower, tcr->lmd_upper);
+	else
+		printf("%5zu) Largest Minimum Distance: %ld\n", tcord, tcr->lmd);
 
 	return 0;
 }
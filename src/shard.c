@@ -0,0 +1,680 @@
+/* SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2022 Juris Miščenko <jxlambda@protonmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Sharded runs.
+ *
+ * All of the test cases of the inputs of a run, taken in order, are split
+ * into as many consecutive slices as there are shards, differing in size by
+ * one at most. Only the number of test cases of each input is needed for
+ * that, which is read off its first line, so every shard comes up with the
+ * same split on its own. Each shard then loads and processes just its slice
+ * of every input, and writes the results out as text:
+ *
+ *     aggrocow-shard 1 INDEX COUNT NINPUTS
+ *     input K NCASES PATH			(for every input)
+ *     set K FIRST NCASES NTC NPTC STATUS	(for every slice of an input)
+ *     LMD LMD_LOWER LMD_UPPER APPROXIMATE	(for every test case of it)
+ *     fail K RC				(upon failure to load input K)
+ *     end
+ *
+ * A run reading every input in full would fail on the first malformed test
+ * case, and only the shard holding it is sure to read it. Shards before it
+ * never get that far, whereas shards after it may skip over it unnoticed or
+ * fail elsewhere in the same input. So upon merging, the failure of the
+ * first input any shard failed on is the one reported by the first shard to
+ * fail on it.
+ *
+ * Likewise, processing stops upon the first test case it fails on. The first
+ * such test case across all shards is where the run would have stopped, the
+ * test cases after it being left unprocessed.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "shard.h"
+
+#define	SHARD_MAGIC	"aggrocow-shard"
+#define	SHARD_VERSION	1
+
+/* State of the shard run by this process */
+struct shard
+{
+	size_t		 sh_index;
+	size_t		 sh_nshards;
+	/* Number of test cases of each input, and of the ones before it */
+	int		 sh_ninputs;
+	size_t		*sh_ncases;
+	size_t		*sh_before;
+	/* Inputs up to the first one failing to be scanned, and its failure */
+	int		 sh_nscanned;
+	enum ac_rc	 sh_scanrc;
+	/* Share of the test cases of all inputs, [sh_first, sh_end) */
+	size_t		 sh_first;
+	size_t		 sh_end;
+	/* Input of every test set added to the context, in order */
+	int		*sh_sets;
+	size_t		 sh_nsets;
+	size_t		 sh_nhandled;
+};
+
+static struct shard sh;
+
+/* A slice of an input, as found in the results of a shard */
+struct merge_slice
+{
+	int				 ms_input;
+	size_t				 ms_first;
+	size_t				 ms_ncases;
+	/* Result of the slice, <ms_ntc> being 0 if it was not processed */
+	size_t				 ms_ntc;
+	size_t				 ms_nptc;
+	enum ac_status			 ms_status;
+	struct ac_test_case_result	*ms_results;
+};
+
+struct merge
+{
+	size_t			 mg_nshards;
+	bool			*mg_seen;
+	int			 mg_ninputs;
+	size_t			*mg_ncases;
+	char			**mg_paths;
+	struct merge_slice	*mg_slices;
+	size_t			 mg_nslices;
+	size_t			 mg_slicescap;
+	/* First input any shard failed to load, -1 for none */
+	int			 mg_failinput;
+	size_t			 mg_failshard;
+	enum ac_rc		 mg_failrc;
+};
+
+/* Parse a non-negative decimal number, up to the first non-digit */
+static bool parse_count(const char *s, char **end, size_t *n)
+{
+	if (s[0] < '0' || s[0] > '9')
+		return false;
+
+	*n = (size_t)strtoull(s, end, 10);
+
+	return true;
+}
+
+bool shard_parse(const char *arg)
+{
+	char *end;
+
+	memset(&sh, 0, sizeof(sh));
+
+	if (!parse_count(arg, &end, &sh.sh_index) || '/' != *end)
+		return false;
+
+	if (!parse_count(end + 1, &end, &sh.sh_nshards) || '\0' != *end)
+		return false;
+
+	return 0 != sh.sh_nshards && sh.sh_index < sh.sh_nshards;
+}
+
+enum ac_rc shard_scan(int ninputs, char *paths[])
+{
+	size_t total = 0, share, rest;
+	int i;
+
+	sh.sh_ninputs = ninputs;
+	sh.sh_ncases = (size_t *)calloc((size_t)ninputs, sizeof(*sh.sh_ncases));
+	sh.sh_before = (size_t *)calloc((size_t)ninputs, sizeof(*sh.sh_before));
+	sh.sh_sets = (int *)calloc((size_t)ninputs, sizeof(*sh.sh_sets));
+	if (NULL == sh.sh_ncases || NULL == sh.sh_before || NULL == sh.sh_sets)
+		return AC_OSERR;
+
+	sh.sh_nscanned = ninputs;
+	sh.sh_scanrc = AC_OK;
+
+	for (i = 0; i < ninputs; i++)
+	{
+		enum ac_rc rc = ac_test_set_ncases(paths[i], &sh.sh_ncases[i]);
+
+		if (AC_OK != rc)
+		{
+			/* The inputs after it are never loaded */
+			sh.sh_ncases[i] = 0;
+			sh.sh_nscanned = i;
+			sh.sh_scanrc = rc;
+			break;
+		}
+
+		sh.sh_before[i] = total;
+		total += sh.sh_ncases[i];
+	}
+
+	/* The first <rest> shards take one test case more than the others */
+	share = total / sh.sh_nshards;
+	rest = total % sh.sh_nshards;
+
+	sh.sh_first = sh.sh_index * share +
+		((sh.sh_index < rest) ? sh.sh_index : rest);
+	sh.sh_end = sh.sh_first + share + ((sh.sh_index < rest) ? 1 : 0);
+
+	printf("%s %d %zu %zu %d\n", SHARD_MAGIC, SHARD_VERSION, sh.sh_index,
+			sh.sh_nshards, ninputs);
+
+	for (i = 0; i < ninputs; i++)
+		printf("input %d %zu %s\n", i, sh.sh_ncases[i], paths[i]);
+
+	return AC_OK;
+}
+
+enum ac_rc shard_slice(int input, struct ac_load_opts *opts)
+{
+	size_t first, end, ncases = sh.sh_ncases[input];
+
+	if (input >= sh.sh_nscanned)
+		return sh.sh_scanrc;
+
+	first = sh.sh_before[input];
+	end = first + ncases;
+
+	if (sh.sh_first > first)
+		first = sh.sh_first;
+	if (sh.sh_end < end)
+		end = sh.sh_end;
+
+	if (first >= end)
+	{
+		/* A slice past the last test case is empty */
+		opts->lo_first = ncases;
+		opts->lo_ncases = 0;
+
+		return AC_OK;
+	}
+
+	opts->lo_first = first - sh.sh_before[input];
+	opts->lo_ncases = end - first;
+
+	/* Leave the parallel reader to an input taken as a whole */
+	if (0 == opts->lo_first && ncases == opts->lo_ncases)
+		opts->lo_ncases = 0;
+
+	return AC_OK;
+}
+
+void shard_loaded(int input)
+{
+	sh.sh_sets[sh.sh_nsets++] = input;
+}
+
+void shard_failed(int input, enum ac_rc rc)
+{
+	printf("fail %d %d\n", input, (int)rc);
+}
+
+enum ac_rc shard_finish(void)
+{
+	enum ac_rc ret = AC_OK;
+
+	printf("end\n");
+
+	if (0 != fflush(stdout) || 0 != ferror(stdout))
+		ret = AC_IOERR;
+
+	free(sh.sh_sets);
+	free(sh.sh_before);
+	free(sh.sh_ncases);
+
+	memset(&sh, 0, sizeof(sh));
+
+	return ret;
+}
+
+int shard_test_set_result_handler(struct ac_test_set *ts,
+		struct ac_test_set_result *tsr)
+{
+	int input = sh.sh_sets[sh.sh_nhandled++];
+
+	printf("set %d %zu %zu %zu %zu %d\n", input, ts->ts_first, ts->ts_ntc,
+			tsr->ntc, tsr->nptc, (int)tsr->status);
+
+	return 0;
+}
+
+int shard_test_case_result_handler(size_t tcord __attribute__((unused)),
+		struct ac_test_case *tc __attribute__((unused)),
+		struct ac_test_case_result *tcr)
+{
+	return printf("%lu %lu %lu %d\n", tcr->lmd, tcr->lmd_lower,
+			tcr->lmd_upper, (int)tcr->approximate);
+}
+
+/* Read a whole line, without its newline, into <buf> of <len> bytes */
+static enum ac_rc read_line(FILE *fp, char *buf, size_t len)
+{
+	size_t n;
+
+	if (NULL == fgets(buf, (int)len, fp))
+	{
+		if (0 != feof(fp))
+			return AC_DATAERR;
+		else
+			return AC_IOERR;
+	}
+
+	n = strlen(buf);
+
+	if (0 == n || '\n' != buf[n - 1])
+		return AC_DATAERR;
+
+	buf[n - 1] = '\0';
+
+	return AC_OK;
+}
+
+static char *copy_string(const char *s)
+{
+	size_t len = strlen(s) + 1;
+	char *copy = (char *)malloc(len);
+
+	if (NULL != copy)
+		memcpy(copy, s, len);
+
+	return copy;
+}
+
+/* Read the list of inputs, which must be the same for every shard */
+static enum ac_rc read_inputs(struct merge *mg, FILE *fp, int ninputs,
+		bool first)
+{
+	enum ac_rc ret;
+	char buf[BUFSIZ];
+	int i;
+
+	if (true == first)
+	{
+		mg->mg_ninputs = ninputs;
+		mg->mg_ncases = (size_t *)calloc((size_t)ninputs,
+				sizeof(*mg->mg_ncases));
+		mg->mg_paths = (char **)calloc((size_t)ninputs,
+				sizeof(*mg->mg_paths));
+		if (NULL == mg->mg_ncases || NULL == mg->mg_paths)
+			return AC_OSERR;
+	}
+	else if (ninputs != mg->mg_ninputs)
+		return AC_DATAERR;
+
+	for (i = 0; i < ninputs; i++)
+	{
+		size_t ncases;
+		int k, n = 0;
+
+		if (AC_OK != (ret = read_line(fp, buf, sizeof(buf))))
+			return ret;
+
+		if (2 != sscanf(buf, "input %d %zu%n", &k, &ncases, &n) ||
+				' ' != buf[n] || k != i)
+			return AC_DATAERR;
+
+		if (true == first)
+		{
+			mg->mg_ncases[i] = ncases;
+			mg->mg_paths[i] = copy_string(&buf[n + 1]);
+			if (NULL == mg->mg_paths[i])
+				return AC_OSERR;
+		}
+		else if (ncases != mg->mg_ncases[i] ||
+				0 != strcmp(&buf[n + 1], mg->mg_paths[i]))
+			return AC_DATAERR;
+	}
+
+	return AC_OK;
+}
+
+/* Read a slice of an input, and the results of its test cases */
+static enum ac_rc read_slice(struct merge *mg, FILE *fp, const char *line)
+{
+	struct merge_slice *slices, *ms;
+	enum ac_rc ret;
+	char buf[BUFSIZ];
+	int status, n = 0;
+	size_t i;
+
+	if (mg->mg_nslices == mg->mg_slicescap)
+	{
+		size_t cap = (0 == mg->mg_slicescap) ? 16 : 2 * mg->mg_slicescap;
+
+		if (cap > SIZE_MAX / sizeof(*slices))
+			return AC_OSERR;
+
+		slices = (struct merge_slice *)realloc(mg->mg_slices,
+				cap * sizeof(*slices));
+		if (NULL == slices)
+			return AC_OSERR;
+
+		mg->mg_slices = slices;
+		mg->mg_slicescap = cap;
+	}
+
+	ms = &mg->mg_slices[mg->mg_nslices];
+	memset(ms, 0, sizeof(*ms));
+
+	if (6 != sscanf(line, "set %d %zu %zu %zu %zu %d%n", &ms->ms_input,
+			&ms->ms_first, &ms->ms_ncases, &ms->ms_ntc,
+			&ms->ms_nptc, &status, &n) || '\0' != line[n])
+		return AC_DATAERR;
+
+	if (ms->ms_input < 0 || ms->ms_input >= mg->mg_ninputs ||
+			ms->ms_first > mg->mg_ncases[ms->ms_input] ||
+			ms->ms_ncases > mg->mg_ncases[ms->ms_input] -
+				ms->ms_first ||
+			ms->ms_nptc > ms->ms_ncases ||
+			(AC_STATUS_OK != status &&
+			 AC_STATUS_INCOMPLETE != status))
+		return AC_DATAERR;
+
+	ms->ms_status = (enum ac_status)status;
+
+	/* Only an empty slice has no results to allocate */
+	if (0 != ms->ms_ncases)
+	{
+		ms->ms_results = (struct ac_test_case_result *)calloc(
+				ms->ms_ncases, sizeof(*ms->ms_results));
+		if (NULL == ms->ms_results)
+			return AC_OSERR;
+	}
+
+	mg->mg_nslices++;
+
+	for (i = 0; i < ms->ms_ncases; i++)
+	{
+		struct ac_test_case_result *tcr = &ms->ms_results[i];
+		int approximate;
+
+		if (AC_OK != (ret = read_line(fp, buf, sizeof(buf))))
+			return ret;
+
+		if (4 != sscanf(buf, "%lu %lu %lu %d%n", &tcr->lmd,
+				&tcr->lmd_lower, &tcr->lmd_upper, &approximate,
+				&n) || '\0' != buf[n])
+			return AC_DATAERR;
+
+		tcr->approximate = (0 != approximate);
+	}
+
+	return AC_OK;
+}
+
+static enum ac_rc read_shard(struct merge *mg, FILE *fp, bool first)
+{
+	enum ac_rc ret;
+	char buf[BUFSIZ];
+	size_t index, nshards;
+	int version, ninputs, input, rc, n = 0;
+
+	if (AC_OK != (ret = read_line(fp, buf, sizeof(buf))))
+		return ret;
+
+	if (4 != sscanf(buf, SHARD_MAGIC " %d %zu %zu %d%n", &version, &index,
+			&nshards, &ninputs, &n) || '\0' != buf[n] ||
+			SHARD_VERSION != version || 0 == nshards ||
+			index >= nshards || ninputs < 0)
+		return AC_DATAERR;
+
+	if (true == first)
+	{
+		mg->mg_nshards = nshards;
+		mg->mg_seen = (bool *)calloc(nshards, sizeof(*mg->mg_seen));
+		if (NULL == mg->mg_seen)
+			return AC_OSERR;
+	}
+	else if (nshards != mg->mg_nshards)
+		return AC_DATAERR;
+
+	if (true == mg->mg_seen[index])
+		return AC_DATAERR;
+
+	mg->mg_seen[index] = true;
+
+	if (AC_OK != (ret = read_inputs(mg, fp, ninputs, first)))
+		return ret;
+
+	for (;;)
+	{
+		if (AC_OK != (ret = read_line(fp, buf, sizeof(buf))))
+			return ret;
+
+		if (0 == strcmp(buf, "end"))
+			break;
+
+		if (0 == strncmp(buf, "set ", strlen("set ")))
+		{
+			if (AC_OK != (ret = read_slice(mg, fp, buf)))
+				return ret;
+
+			continue;
+		}
+
+		if (2 != sscanf(buf, "fail %d %d%n", &input, &rc, &n) ||
+				'\0' != buf[n] || input < 0 ||
+				input >= mg->mg_ninputs ||
+				rc <= (int)AC_OK || rc > (int)AC_NOMEM)
+			return AC_DATAERR;
+
+		if (-1 == mg->mg_failinput || input < mg->mg_failinput ||
+				(input == mg->mg_failinput &&
+				 index < mg->mg_failshard))
+		{
+			mg->mg_failinput = input;
+			mg->mg_failshard = index;
+			mg->mg_failrc = (enum ac_rc)rc;
+		}
+	}
+
+	return AC_OK;
+}
+
+static int compar_slice(const void *a, const void *b)
+{
+	const struct merge_slice *x = (const struct merge_slice *)a;
+	const struct merge_slice *y = (const struct merge_slice *)b;
+
+	if (x->ms_input != y->ms_input)
+		return (x->ms_input < y->ms_input) ? -1 : 1;
+
+	if (x->ms_first != y->ms_first)
+		return (x->ms_first < y->ms_first) ? -1 : 1;
+
+	return 0;
+}
+
+/*
+ * Puts the test set of an input back together from its slices, starting at
+ * <*next>. Upon the first failed test case, <*failed> is set, after which the
+ * rest of the test cases are left unprocessed.
+ */
+static enum ac_rc merge_test_set(struct merge *mg, int input, size_t *next,
+		bool *failed, struct ac_test_set *ts)
+{
+	size_t i, ncases = 0;
+	bool started = !*failed;
+
+	memset(ts, 0, sizeof(*ts));
+
+	ts->ts_ntc = mg->mg_ncases[input];
+	ts->ts_inputpath = copy_string(mg->mg_paths[input]);
+	if (NULL == ts->ts_inputpath)
+		return AC_OSERR;
+
+	if (0 != ts->ts_ntc)
+	{
+		ts->ts_tcs = (struct ac_test_case *)calloc(ts->ts_ntc,
+				sizeof(*ts->ts_tcs));
+		if (NULL == ts->ts_tcs)
+			return AC_OSERR;
+	}
+
+	for (; *next < mg->mg_nslices; (*next)++)
+	{
+		const struct merge_slice *ms = &mg->mg_slices[*next];
+
+		if (ms->ms_input != input)
+			break;
+
+		if (0 == ms->ms_ncases || true == *failed)
+			continue;
+
+		/* Slices must neither overlap nor leave gaps */
+		if (ms->ms_first != ncases || 0 == ms->ms_ntc)
+			return AC_DATAERR;
+
+		for (i = 0; i < ms->ms_ncases; i++)
+		{
+			struct ac_test_case *tc = &ts->ts_tcs[ms->ms_first + i];
+
+			tc->tc_result = ms->ms_results[i];
+
+			if (i < ms->ms_nptc && true == tc->tc_result.approximate)
+				ts->ts_result.napprox++;
+		}
+
+		ts->ts_result.nptc += ms->ms_nptc;
+		ncases += ms->ms_ncases;
+
+		if (AC_STATUS_INCOMPLETE == ms->ms_status)
+		{
+			ts->ts_result.status = AC_STATUS_INCOMPLETE;
+			*failed = true;
+		}
+	}
+
+	if (false == *failed && ncases != ts->ts_ntc)
+		return AC_DATAERR;
+
+	/* Test sets after the failed one are not processed at all */
+	if (true == started)
+		ts->ts_result.ntc = ts->ts_ntc;
+
+	return AC_OK;
+}
+
+static void merge_destroy(struct merge *mg)
+{
+	size_t i;
+	int k;
+
+	for (i = 0; i < mg->mg_nslices; i++)
+		free(mg->mg_slices[i].ms_results);
+
+	for (k = 0; NULL != mg->mg_paths && k < mg->mg_ninputs; k++)
+		free(mg->mg_paths[k]);
+
+	free(mg->mg_slices);
+	free(mg->mg_paths);
+	free(mg->mg_ncases);
+	free(mg->mg_seen);
+}
+
+enum ac_rc shard_merge(struct ac_ctx *ctx, int nfiles, char *paths[])
+{
+	struct merge mg;
+	enum ac_rc ret = AC_OK;
+	size_t i, next = 0;
+	bool failed = false;
+	int k;
+
+	memset(&mg, 0, sizeof(mg));
+	mg.mg_failinput = -1;
+
+	for (k = 0; k < nfiles; k++)
+	{
+		FILE *fp;
+
+		if (0 == strcmp(paths[k], "-"))
+			fp = stdin;
+		else if (NULL == (fp = fopen(paths[k], "r")))
+			ret = AC_NOINPUT;
+
+		if (AC_OK == ret)
+		{
+			ret = read_shard(&mg, fp, 0 == k);
+
+			if (stdin != fp)
+				fclose(fp);
+		}
+
+		if (AC_OK != ret)
+		{
+			fprintf(stderr, "Failed to read shard results from '%s': %s\n",
+					paths[k], ac_strrc(ret));
+			goto out;
+		}
+	}
+
+	for (i = 0; i < mg.mg_nshards; i++)
+	{
+		if (false == mg.mg_seen[i])
+		{
+			fprintf(stderr, "Failed to merge shard results: shard %zu/%zu is missing\n",
+					i, mg.mg_nshards);
+			ret = AC_DATAERR;
+			goto out;
+		}
+	}
+
+	if (-1 != mg.mg_failinput)
+	{
+		fprintf(stderr, "Failed to build test set from input '%s': %s\n",
+				mg.mg_paths[mg.mg_failinput],
+				ac_strrc(mg.mg_failrc));
+		goto out;
+	}
+
+	qsort(mg.mg_slices, mg.mg_nslices, sizeof(*mg.mg_slices),
+			compar_slice);
+
+	/* The results take next to no memory, so let them in regardless */
+	ctx->ac_membudget = 0;
+
+	for (k = 0; k < mg.mg_ninputs; k++)
+	{
+		struct ac_test_set ts;
+
+		ret = merge_test_set(&mg, k, &next, &failed, &ts);
+
+		if (AC_OK == ret)
+			ret = ac_ctx_add_test_set(ctx, &ts);
+
+		if (AC_OK != ret)
+		{
+			ac_test_set_destroy(&ts);
+
+			fprintf(stderr, "Failed to merge shard results of input '%s': %s\n",
+					mg.mg_paths[k], ac_strrc(ret));
+			goto out;
+		}
+	}
+
+	ac_ctx_process_results(ctx);
+
+	if (true == failed)
+		ret = AC_FAIL;
+
+out:
+	merge_destroy(&mg);
+
+	return ret;
+}
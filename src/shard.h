@@ -0,0 +1,97 @@
+/* SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2022 Juris Miščenko <jxlambda@protonmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Splitting the test cases of a run across several processes, and merging
+ * their results back together.
+ */
+
+#ifndef	AGGROCOW_SHARD_H
+#define	AGGROCOW_SHARD_H	1
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <aggrocow.h>
+
+/* Parse a shard given as "INDEX/COUNT"
+ *
+ * @return false if <arg> is not a valid shard, true otherwise.
+ */
+bool shard_parse(const char *arg);
+
+/* Find the share of the test cases of the inputs given to the shard
+ * @ninputs number of inputs
+ * @paths paths to the inputs, in the order they are given
+ *
+ * Reads the number of test cases of every input, up to the first one it
+ * cannot be read from, and splits all of the test cases before it evenly
+ * between the shards, in order. Writes out the header of the shard results.
+ *
+ * @return <AC_OSERR> upon failure to allocate memory, <AC_OK> otherwise.
+ */
+enum ac_rc shard_scan(int ninputs, char *paths[]);
+
+/* Narrow the options to load an input with down to the share of the shard
+ * @input index of the input
+ * @opts pointer to the options to set the slice of test cases in
+ *
+ * The slice is empty if the shard has no test cases of the input.
+ *
+ * @return the failure to read the number of test cases of the input, if any,
+ *         <AC_OK> otherwise.
+ */
+enum ac_rc shard_slice(int input, struct ac_load_opts *opts);
+
+/* Record that the test set of an input was added to the context */
+void shard_loaded(int input);
+
+/* Record the failure to build the test set of an input */
+void shard_failed(int input, enum ac_rc rc);
+
+/* Write out the end of the shard results and release the state of the shard
+ *
+ * @return <AC_IOERR> upon failure to write the results, <AC_OK> otherwise.
+ */
+enum ac_rc shard_finish(void);
+
+/* Handlers writing the results of a shard out, for <ac_ctx_process_results> */
+int shard_test_set_result_handler(struct ac_test_set *ts,
+		struct ac_test_set_result *tsr);
+int shard_test_case_result_handler(size_t tcord, struct ac_test_case *tc,
+		struct ac_test_case_result *tcr);
+
+/* Merge the results of all the shards of a run
+ * @ctx pointer to a context with the result handlers of the run installed
+ * @nfiles number of files with shard results
+ * @paths paths to the files with shard results
+ *
+ * Puts the test sets of the run back together from the results of its shards
+ * and hands them to the result handlers of <ctx>, just as the run would have
+ * in a single process. Upon a failure to build a test set, reports the one
+ * the run would have failed on instead.
+ *
+ * @return <AC_DATAERR> if the shard results are malformed, incomplete or not
+ *         of the same run,
+ *         <AC_NOINPUT> or <AC_IOERR> upon failing to read them,
+ *         <AC_OSERR> upon failure to allocate memory,
+ *         <AC_FAIL> if processing a test case failed,
+ *         <AC_OK> otherwise.
+ */
+enum ac_rc shard_merge(struct ac_ctx *ctx, int nfiles, char *paths[]);
+
+#endif /* !AGGROCOW_SHARD_H */
@@ -0,0 +1,69 @@
+#!/bin/sh
+#
+# A run within a time budget has to yield what a run without one does, except
+# for approximate results, which have to be ranges containing the exact one.
+
+. "$(dirname "$0")/common.sh"
+
+# contained WHAT NAME NAME: fail unless the second run is the first, but for
+# ranges containing its results
+contained()
+{
+	for ext in err rc
+	do
+		if ! cmp -s "$WORKDIR/$2.$ext" "$WORKDIR/$3.$ext"
+		then
+			echo "$1: '$2' and '$3' differ in $ext" >&2
+			failed=1
+
+			return
+		fi
+	done
+
+	# Results go up to 2^62, so they are compared as strings of digits
+	paste -d ' ' "$WORKDIR/$2.out" "$WORKDIR/$3.out" | awk -v what="$1" '
+	function le(a, b)
+	{
+		return length(a) < length(b) ||
+			(length(a) == length(b) && a "" <= b "")
+	}
+
+	{
+		ok = 0
+
+		if (NF == 2)
+			ok = ($1 "" == $2 "")
+		else if (NF == 3 && $2 ~ /^\[[0-9]+,$/ && $3 ~ /^[0-9]+\]$/)
+		{
+			lo = substr($2, 2, length($2) - 2)
+			hi = substr($3, 1, length($3) - 1)
+			ok = le(lo, $1) && le($1, hi)
+		}
+
+		if (!ok)
+		{
+			printf "%s: line %d: %s\n", what, NR, $0 > "/dev/stderr"
+			bad = 1
+		}
+	}
+
+	END { exit bad }' || failed=1
+}
+
+for seed in $(seq 1 40)
+do
+	case $((seed % 4)) in
+	0) generate in -b "$seed" ;;
+	1) generate in -m "$seed" ;;
+	*) generate in "$seed" ;;
+	esac
+
+	run exact "$AGGROCOW" in
+	for msec in 1 2 5 20
+	do
+		run budget "$AGGROCOW" -d "$msec" in
+		contained "seed $seed, $msec ms" exact budget
+	done
+done
+
+exit $failed
@@ -0,0 +1,47 @@
+# Shared by the scripts diffing one way of running aggrocow against another.
+#
+# Each script is run with the path to the aggrocow executable and to the input
+# generator, and sources this file. Runs are recorded under a name, as their
+# standard output, standard error and exit status, which all have to match.
+
+case $1 in /*) AGGROCOW=$1 ;; *) AGGROCOW=$PWD/$1 ;; esac
+case $2 in /*) GEN=$2 ;; *) GEN=$PWD/$2 ;; esac
+WORKDIR=$(mktemp -d) || exit 1
+failed=0
+
+trap 'rm -rf "$WORKDIR"' EXIT
+
+# generate FILE [FLAGS..] SEED: write a generated input to FILE
+generate()
+{
+	file=$1
+	shift
+
+	"$GEN" "$@" > "$WORKDIR/$file" || exit 1
+}
+
+# run NAME COMMAND..: run COMMAND in the working directory, recording it as NAME
+run()
+{
+	name=$1
+	shift
+
+	(cd "$WORKDIR" && "$@") > "$WORKDIR/$name.out" 2> "$WORKDIR/$name.err"
+	echo $? > "$WORKDIR/$name.rc"
+}
+
+# same WHAT NAME NAME: fail unless both runs did the same
+same()
+{
+	for ext in out err rc
+	do
+		if ! cmp -s "$WORKDIR/$2.$ext" "$WORKDIR/$3.$ext"
+		then
+			echo "$1: '$2' and '$3' differ in $ext" >&2
+			diff "$WORKDIR/$2.$ext" "$WORKDIR/$3.$ext" | head -n 10 >&2
+			failed=1
+
+			return
+		fi
+	done
+}
@@ -0,0 +1,24 @@
+#!/bin/sh
+#
+# Solving identical stall lists once, across test cases and test sets alike,
+# has to yield what solving each of them does.
+
+. "$(dirname "$0")/common.sh"
+
+for seed in $(seq 1 40)
+do
+	generate a -d "$seed"
+	case $((seed % 3)) in
+	0) generate b -d -m "$seed" ;;
+	*) generate b -d $((seed + 1000)) ;;
+	esac
+
+	run plain "$AGGROCOW" -v a b
+	run dedup "$AGGROCOW" -v -D a b
+	same "seed $seed" plain dedup
+
+	run dedup "$AGGROCOW" -v -D -j 4 a b
+	same "seed $seed, 4 jobs" plain dedup
+done
+
+exit $failed
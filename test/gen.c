@@ -0,0 +1,284 @@
+/* SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2022 Juris Miščenko <jxlambda@protonmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Generator of test inputs, written to the standard output.
+ *
+ * The same seed always yields the same input, so that a failing test can be
+ * reproduced by hand. Flags:
+ *
+ *   -b  few test cases with a lot of stalls each
+ *   -d  test cases sharing their stalls, in any order
+ *   -m  a malformed input, damaged at a random line
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_CASES	30
+#define MAX_BASES	4
+
+struct gen
+{
+	unsigned long long int	g_state;
+	bool			g_big;
+	bool			g_dup;
+	bool			g_malformed;
+	/* Line to damage, and how; counted from 1 */
+	size_t			g_badline;
+	unsigned int		g_badkind;
+	size_t			g_line;
+};
+
+/* Lines put in place of a damaged one */
+static const char *const garbage[] =
+{
+	"x", "", " ", "-5", " +7 z", "5 ", "1 2 3", "a b",
+	"0 2", "3 0", "2 9", "99999999999999999999999",
+};
+
+#define NGARBAGE	(sizeof(garbage) / sizeof(garbage[0]))
+
+/* splitmix64, for a sequence that does not depend on the C library */
+static unsigned long long int next(struct gen *g)
+{
+	unsigned long long int z = (g->g_state += 0x9e3779b97f4a7c15ULL);
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+
+	return z ^ (z >> 31);
+}
+
+/* Return a number in [0, n) */
+static unsigned long long int below(struct gen *g, unsigned long long int n)
+{
+	return (0 == n) ? 0 : next(g) % n;
+}
+
+static unsigned long int draw_max(struct gen *g)
+{
+	static const unsigned long int maxes[] =
+	{
+		10, 1000, 1000000000UL, 1UL << 40, 1UL << 62,
+	};
+
+	return maxes[below(g, sizeof(maxes) / sizeof(maxes[0]))];
+}
+
+static size_t draw_nstalls(struct gen *g)
+{
+	static const size_t nstalls[] = { 2, 3, 5, 10, 50, 300, 1000, 5000 };
+
+	if (true == g->g_big)
+		return 150000 + below(g, 150000);
+
+	return nstalls[below(g, sizeof(nstalls) / sizeof(nstalls[0]))];
+}
+
+static unsigned long int draw_ncows(struct gen *g, size_t nstalls)
+{
+	if (0 == below(g, 2))
+		return 2 + below(g, nstalls - 1);
+
+	return 2 + below(g, (nstalls < 5 ? nstalls : 5) - 1);
+}
+
+/*
+ * Write out a line, unless it is the one to damage, in which case it is
+ * replaced, cut short, put behind more zeros than fit in BUFSIZ, which
+ * fgets(3) reads as several lines, or ends the input altogether.
+ *
+ * Return false once the input has ended.
+ */
+static bool emit(struct gen *g, const char *line)
+{
+	size_t len = strlen(line);
+	unsigned long long int n;
+
+	if (++g->g_line != g->g_badline)
+	{
+		printf("%s\n", line);
+		return true;
+	}
+
+	switch (g->g_badkind)
+	{
+	case 0:
+		return false;
+	case 1:
+		printf("%.*s", (int)below(g, len + 1), line);
+		return false;
+	case 2:
+		for (n = BUFSIZ + below(g, BUFSIZ); n > 0; n--)
+			putchar('0');
+		printf("%s\n", line);
+		return true;
+	default:
+		printf("%s\n", garbage[below(g, NGARBAGE)]);
+		return true;
+	}
+}
+
+static void shuffle(struct gen *g, unsigned long int *stalls, size_t nstalls)
+{
+	size_t i;
+
+	for (i = nstalls; i > 1; i--)
+	{
+		size_t j = (size_t)below(g, i);
+		unsigned long int t = stalls[i - 1];
+
+		stalls[i - 1] = stalls[j];
+		stalls[j] = t;
+	}
+}
+
+static int generate(struct gen *g)
+{
+	unsigned long int *bases[MAX_BASES], *stalls = NULL;
+	size_t nbases[MAX_BASES], ncases, nlines, i, j;
+	size_t sizes[MAX_CASES], picks[MAX_CASES];
+	char line[64];
+	int ret = EXIT_FAILURE;
+
+	memset(bases, 0, sizeof(bases));
+
+	for (i = 0; true == g->g_dup && i < MAX_BASES; i++)
+	{
+		unsigned long int max = draw_max(g);
+
+		nbases[i] = draw_nstalls(g);
+		if (NULL == (bases[i] = calloc(nbases[i], sizeof(*bases[i]))))
+			goto out;
+
+		for (j = 0; j < nbases[i]; j++)
+			bases[i][j] = (unsigned long int)below(g, max);
+	}
+
+	ncases = 1 + below(g, (true == g->g_big) ? 3 : MAX_CASES);
+
+	for (i = 0, nlines = 1; i < ncases; i++)
+	{
+		if (true == g->g_dup)
+		{
+			picks[i] = (size_t)below(g, MAX_BASES);
+			sizes[i] = nbases[picks[i]];
+		}
+		else
+			sizes[i] = draw_nstalls(g);
+
+		nlines += 1 + sizes[i];
+	}
+
+	if (true == g->g_malformed)
+	{
+		g->g_badline = 1 + below(g, nlines);
+		g->g_badkind = (unsigned int)below(g, 5);
+	}
+
+	snprintf(line, sizeof(line), "%zu", ncases);
+	if (false == emit(g, line))
+		goto done;
+
+	for (i = 0; i < ncases; i++)
+	{
+		unsigned long int max = draw_max(g), ncows;
+		size_t nstalls = sizes[i];
+
+		free(stalls);
+		if (NULL == (stalls = calloc(nstalls, sizeof(*stalls))))
+			goto out;
+
+		if (true == g->g_dup)
+		{
+			memcpy(stalls, bases[picks[i]],
+					nstalls * sizeof(*stalls));
+			if (0 == below(g, 2))
+				shuffle(g, stalls, nstalls);
+			if (0 == below(g, 10))
+				stalls[0]++;
+		}
+		else
+		{
+			for (j = 0; j < nstalls; j++)
+				stalls[j] = (unsigned long int)below(g, max);
+		}
+
+		ncows = draw_ncows(g, nstalls);
+
+		snprintf(line, sizeof(line), "%zu %lu", nstalls, ncows);
+		if (false == emit(g, line))
+			goto done;
+
+		for (j = 0; j < nstalls; j++)
+		{
+			snprintf(line, sizeof(line), "%lu", stalls[j]);
+			if (false == emit(g, line))
+				goto done;
+		}
+	}
+
+done:
+	ret = (0 == fflush(stdout) && 0 == ferror(stdout)) ?
+		EXIT_SUCCESS : EXIT_FAILURE;
+
+out:
+	free(stalls);
+	for (i = 0; i < MAX_BASES; i++)
+		free(bases[i]);
+
+	return ret;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: gen [-b] [-d] [-m] SEED\n");
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	struct gen g;
+	char *end;
+	int i;
+
+	memset(&g, 0, sizeof(g));
+
+	for (i = 1; i < argc && '-' == argv[i][0]; i++)
+	{
+		if (0 == strcmp(argv[i], "-b"))
+			g.g_big = true;
+		else if (0 == strcmp(argv[i], "-d"))
+			g.g_dup = true;
+		else if (0 == strcmp(argv[i], "-m"))
+			g.g_malformed = true;
+		else
+			usage();
+	}
+
+	if (i + 1 != argc)
+		usage();
+
+	g.g_state = strtoull(argv[i], &end, 10);
+	if ('\0' == *argv[i] || '\0' != *end)
+		usage();
+
+	return generate(&g);
+}
@@ -0,0 +1,58 @@
+#!/bin/sh
+#
+# Reading the slices of a sharded run through the index of an input has to
+# yield what skipping over the test cases before them does, whether the index
+# is built, reused or out of date, and the input malformed or not.
+
+. "$(dirname "$0")/common.sh"
+
+# compare WHAT NSHARDS: diff every shard of a run with and without an index
+compare()
+{
+	for i in $(seq 0 $(($2 - 1)))
+	do
+		run plain "$AGGROCOW" -s "$i/$2" a b
+		run indexed "$AGGROCOW" -x -s "$i/$2" a b
+		same "$1, shard $i/$2" plain indexed
+	done
+}
+
+# mode FILE: print the permission bits of FILE
+mode()
+{
+	ls -l "$WORKDIR/$1" | cut -c 2-10
+}
+
+for seed in $(seq 1 30)
+do
+	case $((seed % 3)) in
+	0) generate a -m "$seed" ;;
+	*) generate a "$seed" ;;
+	esac
+	generate b $((seed + 1000))
+	rm -f "$WORKDIR/a.acidx" "$WORKDIR/b.acidx"
+
+	if [ 0 -eq $((seed % 2)) ]
+	then
+		chmod 600 "$WORKDIR/a"
+	fi
+
+	nshards=$((seed % 5 + 2))
+
+	compare "seed $seed, new index" "$nshards"
+	compare "seed $seed, existing index" "$nshards"
+
+	if [ -f "$WORKDIR/a.acidx" ] && [ "$(mode a)" != "$(mode a.acidx)" ]
+	then
+		echo "seed $seed: index of mode $(mode a.acidx)," \
+			"input of mode $(mode a)" >&2
+		failed=1
+	fi
+
+	generate a $((seed + 2000))
+	touch -t 200001010000 "$WORKDIR/a"
+
+	compare "seed $seed, stale index" "$nshards"
+done
+
+exit $failed
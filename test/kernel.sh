@@ -0,0 +1,37 @@
+#!/bin/sh
+#
+# Every kernel the CPU supports has to yield what the scalar one does. A kernel
+# named in AGGROCOW_KERNEL that the CPU does not support is not selected, in
+# which case the one reported by the third argument is the scalar one.
+
+. "$(dirname "$0")/common.sh"
+
+case $3 in /*) ISA=$3 ;; *) ISA=$PWD/$3 ;; esac
+
+kernels=""
+for kernel in sse4.2 avx2 avx512
+do
+	if [ "$(AGGROCOW_KERNEL=$kernel "$ISA")" = "$kernel" ]
+	then
+		kernels="$kernels $kernel"
+	else
+		echo "skipping $kernel, which the CPU does not support" >&2
+	fi
+done
+
+for seed in $(seq 1 40)
+do
+	case $((seed % 4)) in
+	0) generate in -b "$seed" ;;
+	*) generate in "$seed" ;;
+	esac
+
+	run scalar env AGGROCOW_KERNEL=scalar "$AGGROCOW" -v in
+	for kernel in $kernels
+	do
+		run "$kernel" env AGGROCOW_KERNEL="$kernel" "$AGGROCOW" -v in
+		same "seed $seed" scalar "$kernel"
+	done
+done
+
+exit $failed
@@ -0,0 +1,104 @@
+#!/bin/sh
+#
+# A run within a memory limit has to yield what a run without one does, but
+# for the peak memory it reports, which has to be within the limit. Inputs
+# that do not fit alongside the ones before them are deferred until those are
+# done with, and an input that does not fit on its own ends the run after the
+# results of the inputs before it.
+
+. "$(dirname "$0")/common.sh"
+
+# peak NAME: print the peak memory a run reports, dropping it from its output
+peak()
+{
+	sed -n 's/^\[\*\] Peak memory \[bytes\]: \[\([0-9]*\)\]$/\1/p' \
+		"$WORKDIR/$1.out"
+	sed '/^\[\*\] Peak memory/d' "$WORKDIR/$1.out" > "$WORKDIR/$1.tmp"
+	mv "$WORKDIR/$1.tmp" "$WORKDIR/$1.out"
+}
+
+deferred=0
+rejected=0
+
+for seed in $(seq 1 20)
+do
+	generate a $((seed * 3))
+	generate b $((seed * 3 + 1))
+	generate c $((seed * 3 + 2))
+
+	run plain "$AGGROCOW" -v a b c
+
+	# The first limit is never reached, and the peak it reports is the one
+	# of the whole run
+	for limit in 1099511627776 1000000 400000 300000 200000 100000
+	do
+		what="seed $seed, limit $limit"
+
+		run limited "$AGGROCOW" -v -M "$limit" a b c
+		used=$(peak limited)
+
+		if [ -n "$used" ]
+		then
+			[ "$limit" = 1099511627776 ] && total=$used
+			[ "$used" -lt "$total" ] && deferred=$((deferred + 1))
+
+			if [ "$used" -gt "$limit" ]
+			then
+				echo "$what: $used bytes used" >&2
+				failed=1
+			fi
+
+			same "$what" plain limited
+			continue
+		fi
+
+		failure="^Failed to build test set from input '\\(.*\\)'"
+		input=$(sed -n "s/$failure: Memory budget exceeded\$/\\1/p" \
+			"$WORKDIR/limited.err")
+		case $input in
+		a) before="" ;;
+		b) before="a" ;;
+		c) before="a b" ;;
+		*)
+			echo "$what: no results and no input rejected" >&2
+			failed=1
+			continue
+			;;
+		esac
+
+		rejected=$((rejected + 1))
+
+		run alone "$AGGROCOW" -v -M "$limit" "$input"
+		if [ -n "$(peak alone)" ]
+		then
+			echo "$what: '$input' rejected, though it fits alone" >&2
+			failed=1
+		fi
+
+		# Nothing is printed with no input before the rejected one
+		if [ -n "$before" ]
+		then
+			run expected "$AGGROCOW" -v $before
+		else
+			run expected true
+		fi
+
+		for ext in out rc
+		do
+			if ! cmp -s "$WORKDIR/expected.$ext" "$WORKDIR/limited.$ext"
+			then
+				echo "$what: '$input' rejected, results differ in $ext" >&2
+				failed=1
+			fi
+		done
+	done
+done
+
+# Both have to have come up for the limits to have been put to the test
+if [ "$deferred" -eq 0 ] || [ "$rejected" -eq 0 ]
+then
+	echo "$deferred runs deferred an input, $rejected rejected one" >&2
+	failed=1
+fi
+
+exit $failed
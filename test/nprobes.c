@@ -0,0 +1,174 @@
+/* SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2022 Juris Miščenko <jxlambda@protonmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * A search cut short after a number of feasibility probes has to yield bounds
+ * containing the exact result, which narrow down to it as the number grows.
+ * Once the limit is beyond the probes the search takes, the result has to be
+ * the exact one.
+ */
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <aggrocow.h>
+
+#define NROUNDS		500
+#define MAX_STALLS	300
+/* More probes than any search over unsigned long int stall indices takes */
+#define MAX_PROBES	70
+
+static unsigned long long int state;
+
+/* splitmix64, for a sequence that does not depend on the C library */
+static unsigned long long int below(unsigned long long int n)
+{
+	unsigned long long int z = (state += 0x9e3779b97f4a7c15ULL);
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+
+	return (0 == n) ? 0 : (z ^ (z >> 31)) % n;
+}
+
+/* Check a result against the exact one and the one with a probe less */
+static bool consistent(const struct ac_test_case_result *tcr,
+		const struct ac_test_case_result *exact,
+		const struct ac_test_case_result *prev)
+{
+	/* The bounds only ever narrow down */
+	if (tcr->lmd_lower < prev->lmd_lower || tcr->lmd_upper > prev->lmd_upper)
+		return false;
+
+	if (false == tcr->approximate)
+		return tcr->lmd == exact->lmd &&
+			tcr->lmd_lower == exact->lmd &&
+			tcr->lmd_upper == exact->lmd;
+
+	/* Once exact, a result stays so with more probes */
+	return true == prev->approximate &&
+		tcr->lmd == tcr->lmd_lower &&
+		tcr->lmd_lower <= exact->lmd && exact->lmd <= tcr->lmd_upper;
+}
+
+static bool sweep(unsigned int round, struct ac_test_case *tc)
+{
+	struct ac_test_case_result exact, prev, *tcr = &tc->tc_result;
+	struct ac_budget budget = { 0, 0 };
+	unsigned long int nprobes;
+	enum ac_rc rc;
+
+	if (AC_OK != (rc = ac_test_case_process(tc)))
+	{
+		fprintf(stderr, "round %u: %s\n", round, ac_strrc(rc));
+		return false;
+	}
+
+	exact = *tcr;
+	prev = exact;
+	prev.lmd_lower = 0;
+	prev.lmd_upper = ULONG_MAX;
+	prev.approximate = true;
+
+	for (nprobes = 1; nprobes <= MAX_PROBES; nprobes++)
+	{
+		budget.b_nprobes = nprobes;
+
+		if (AC_OK != (rc = ac_test_case_process_budget(tc, &budget)))
+		{
+			fprintf(stderr, "round %u, %lu probes: %s\n", round,
+					nprobes, ac_strrc(rc));
+			return false;
+		}
+
+		if (false == consistent(tcr, &exact, &prev))
+		{
+			fprintf(stderr, "round %u, %lu probes: [%lu, %lu]%s "
+					"after [%lu, %lu], exact %lu\n",
+					round, nprobes,
+					tcr->lmd_lower, tcr->lmd_upper,
+					(true == tcr->approximate) ?
+					" (approximate)" : "",
+					prev.lmd_lower, prev.lmd_upper,
+					exact.lmd);
+			return false;
+		}
+
+		prev = *tcr;
+	}
+
+	if (true == prev.approximate)
+	{
+		fprintf(stderr, "round %u: still approximate after %u probes\n",
+				round, MAX_PROBES);
+		return false;
+	}
+
+	return true;
+}
+
+static bool round_trip(unsigned int round)
+{
+	struct ac_test_case tc;
+	unsigned long int *stalls, max, ncows;
+	size_t nstalls, i;
+	bool ok = false;
+
+	nstalls = 1 + below(MAX_STALLS);
+	ncows = (0 == below(4)) ? 1 : 1 + below(nstalls);
+	max = (0 == below(2)) ? 1 + below(1000) : ULONG_MAX;
+
+	if (NULL == (stalls = calloc(nstalls, sizeof(*stalls))))
+		goto out;
+
+	for (i = 0; i < nstalls; i++)
+		stalls[i] = below(max);
+
+	if (AC_OK != ac_test_case_from_borrowed(nstalls, ncows, stalls,
+			AC_STALLS_UNSORTED, &tc))
+		goto out;
+
+	ok = sweep(round, &tc);
+
+	ac_test_case_destroy(&tc);
+
+out:
+	if (false == ok)
+		fprintf(stderr, "round %u failed\n", round);
+
+	free(stalls);
+
+	return ok;
+}
+
+int main(void)
+{
+	int ret = EXIT_SUCCESS;
+	unsigned int round;
+
+	for (round = 1; round <= NROUNDS; round++)
+	{
+		state = round;
+
+		if (false == round_trip(round))
+			ret = EXIT_FAILURE;
+	}
+
+	return ret;
+}
@@ -0,0 +1,23 @@
+#!/bin/sh
+#
+# Solving test cases whose stalls do not fit the memory budget out of core has
+# to yield what solving them in memory does, malformed inputs failing alike.
+
+. "$(dirname "$0")/common.sh"
+
+for seed in $(seq 1 9)
+do
+	case $((seed % 3)) in
+	0) generate in -b -m "$seed" ;;
+	*) generate in -b "$seed" ;;
+	esac
+
+	run memory "$AGGROCOW" -v in
+	for budget in 1048576 2097152
+	do
+		run ooc "$AGGROCOW" -v -m "$budget" -T . in
+		same "seed $seed, $budget bytes" memory ooc
+	done
+done
+
+exit $failed
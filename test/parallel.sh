@@ -0,0 +1,23 @@
+#!/bin/sh
+#
+# Parsing an input with several workers has to yield what parsing it serially
+# does, down to the error a malformed input fails with.
+
+. "$(dirname "$0")/common.sh"
+
+for seed in $(seq 1 60)
+do
+	case $((seed % 3)) in
+	0) generate in -m "$seed" ;;
+	*) generate in "$seed" ;;
+	esac
+
+	run serial "$AGGROCOW" -v in
+	for jobs in 2 3 8
+	do
+		run parallel "$AGGROCOW" -v -j "$jobs" in
+		same "seed $seed, $jobs jobs" serial parallel
+	done
+done
+
+exit $failed
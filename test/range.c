@@ -0,0 +1,213 @@
+/* SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2022 Juris Miščenko <jxlambda@protonmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Range queries, answered together, have to yield what solving a test case
+ * made of the stalls in the range of each one does. Queries are generated
+ * around a few shared first stalls, so that runs of nested ranges are common,
+ * and some of them are invalid: reversed, empty, or with fewer stalls in range
+ * than cows to place.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <aggrocow.h>
+
+#define NROUNDS		300
+#define MAX_STALLS	400
+#define MAX_QUERIES	200
+
+static unsigned long long int state;
+
+/* splitmix64, for a sequence that does not depend on the C library */
+static unsigned long long int below(unsigned long long int n)
+{
+	unsigned long long int z = (state += 0x9e3779b97f4a7c15ULL);
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+
+	return (0 == n) ? 0 : (z ^ (z >> 31)) % n;
+}
+
+static int compar_stall(const void *a, const void *b)
+{
+	unsigned long int x = *(const unsigned long int *)a;
+	unsigned long int y = *(const unsigned long int *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* Solve a query by hand, from the stalls in its range */
+static enum ac_rc solve(const unsigned long int *stalls, size_t nstalls,
+		const struct ac_range_query *rq, struct ac_test_case_result *tcr)
+{
+	struct ac_test_case tc;
+	unsigned long int *inrange;
+	size_t i, n = 0;
+	enum ac_rc ret;
+
+	memset(tcr, 0, sizeof(*tcr));
+
+	if (NULL == (inrange = calloc(nstalls, sizeof(*inrange))))
+		return AC_OSERR;
+
+	for (i = 0; i < nstalls; i++)
+		if (stalls[i] >= rq->rq_first && stalls[i] <= rq->rq_last)
+			inrange[n++] = stalls[i];
+
+	ret = ac_test_case_from_borrowed(n, rq->rq_ncows, inrange,
+			AC_STALLS_UNSORTED, &tc);
+	if (AC_OK == ret && AC_OK == (ret = ac_test_case_process(&tc)))
+		*tcr = tc.tc_result;
+
+	if (AC_OK == ret)
+		ac_test_case_destroy(&tc);
+	free(inrange);
+
+	return ret;
+}
+
+static bool check(unsigned int round, const char *how,
+		const unsigned long int *stalls, size_t nstalls,
+		const struct ac_range_query *queries, size_t nqueries)
+{
+	struct ac_test_case_result tcr;
+	bool ok = true;
+	enum ac_rc rc;
+	size_t i;
+
+	for (i = 0; i < nqueries; i++)
+	{
+		const struct ac_range_query *rq = &queries[i];
+
+		rc = solve(stalls, nstalls, rq, &tcr);
+		if (rc == rq->rq_rc && (AC_OK != rc ||
+				(tcr.lmd == rq->rq_result.lmd &&
+				 tcr.lmd_lower == rq->rq_result.lmd_lower &&
+				 tcr.lmd_upper == rq->rq_result.lmd_upper &&
+				 tcr.approximate == rq->rq_result.approximate)))
+			continue;
+
+		fprintf(stderr, "round %u, %s, query %zu [%lu, %lu] "
+				"of %lu cows: %s, %lu; expected %s, %lu\n",
+				round, how, i,
+				rq->rq_first, rq->rq_last, rq->rq_ncows,
+				ac_strrc(rq->rq_rc), rq->rq_result.lmd,
+				ac_strrc(rc), tcr.lmd);
+		ok = false;
+	}
+
+	return ok;
+}
+
+static bool round_trip(unsigned int round)
+{
+	struct ac_range_query *queries;
+	unsigned long int *stalls, *sorted, max, first[3];
+	size_t nstalls, nqueries, i;
+	unsigned int nworkers;
+	bool ok = false;
+
+	nstalls = 1 + below(MAX_STALLS);
+	nqueries = below(MAX_QUERIES);
+	max = 1 + below((0 == below(2)) ? 20 : 100000);
+	nworkers = 1 + (unsigned int)below(4);
+
+	stalls = calloc(nstalls, sizeof(*stalls));
+	sorted = calloc(nstalls, sizeof(*sorted));
+	queries = calloc(nqueries + 1, sizeof(*queries));
+	if (NULL == stalls || NULL == sorted || NULL == queries)
+		goto out;
+
+	for (i = 0; i < nstalls; i++)
+		stalls[i] = below(max);
+
+	memcpy(sorted, stalls, nstalls * sizeof(*sorted));
+	qsort(sorted, nstalls, sizeof(*sorted), compar_stall);
+
+	for (i = 0; i < sizeof(first) / sizeof(first[0]); i++)
+		first[i] = below(max);
+
+	for (i = 0; i < nqueries; i++)
+	{
+		struct ac_range_query *rq = &queries[i];
+
+		rq->rq_first = (0 != below(3)) ? first[below(3)] : below(max);
+		rq->rq_last = (0 != below(3)) ? rq->rq_first + below(max) :
+			below(max);
+		rq->rq_ncows = below(8);
+	}
+
+	if (AC_OK != ac_range_process(nstalls, stalls, AC_STALLS_UNSORTED,
+			nqueries, queries, nworkers))
+		goto out;
+
+	if (false == check(round, "unsorted", stalls, nstalls, queries,
+			nqueries))
+		goto out;
+
+	if (AC_OK != ac_range_process(nstalls, sorted, AC_STALLS_SORTED,
+			nqueries, queries, nworkers))
+		goto out;
+
+	ok = check(round, "sorted", stalls, nstalls, queries, nqueries);
+
+out:
+	if (false == ok)
+		fprintf(stderr, "round %u failed\n", round);
+
+	free(queries);
+	free(sorted);
+	free(stalls);
+
+	return ok;
+}
+
+int main(void)
+{
+	struct ac_range_query rq;
+	unsigned long int stall = 0;
+	int ret = EXIT_SUCCESS;
+	unsigned int round;
+
+	memset(&rq, 0, sizeof(rq));
+
+	if (AC_EINVAL != ac_range_process(0, &stall, AC_STALLS_SORTED, 1, &rq,
+			1) ||
+			AC_EINVAL != ac_range_process(1, NULL, AC_STALLS_SORTED,
+				1, &rq, 1) ||
+			AC_EINVAL != ac_range_process(1, &stall,
+				AC_STALLS_SORTED, 1, NULL, 1))
+	{
+		fprintf(stderr, "invalid arguments accepted\n");
+		ret = EXIT_FAILURE;
+	}
+
+	for (round = 1; round <= NROUNDS; round++)
+	{
+		state = round;
+
+		if (false == round_trip(round))
+			ret = EXIT_FAILURE;
+	}
+
+	return ret;
+}
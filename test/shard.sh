@@ -0,0 +1,41 @@
+#!/bin/sh
+#
+# Merging the results of a run split into shards has to yield what the run
+# does in one go, including the error it stops at for a malformed or missing
+# input.
+
+. "$(dirname "$0")/common.sh"
+
+for seed in $(seq 1 40)
+do
+	generate a $((seed * 3))
+	generate b -m $((seed * 3 + 1))
+	generate c $((seed * 3 + 2))
+
+	case $((seed % 4)) in
+	0) inputs="a missing c" ;;
+	1) inputs="a b c" ;;
+	*) inputs="a c" ;;
+	esac
+
+	case $((seed % 3)) in
+	0) opts="-j 3" ;;
+	1) opts="-D" ;;
+	*) opts="" ;;
+	esac
+
+	run single "$AGGROCOW" -v $opts $inputs
+
+	nshards=$((seed % 6 + 1))
+	shards=""
+	for i in $(seq 0 $((nshards - 1)))
+	do
+		run "shard$i" "$AGGROCOW" $opts -s "$i/$nshards" $inputs
+		shards="$shards shard$i.out"
+	done
+
+	run merged "$AGGROCOW" -v -g $shards
+	same "seed $seed, $nshards shards" single merged
+done
+
+exit $failed